@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+/* The dispatch under test is static */
+#include "window.c"
+
+/*
+ * Drives a context with a batch function through WKE_BEGIN and pointer
+ * events without a compositor, and checks what it is handed and what
+ * stays held. Run by hand, built like example.c but with this file in
+ * place of window.c and example.c. Exits non-zero on the first failure.
+ */
+
+#define TEST_POINTERS   5
+
+static struct {
+    int begins, pointers, calls;
+    int take;   /* Pointer events to take per call, -1 for all */
+} _seen;
+
+static int _batch(struct wk_context *ctx, struct wk_event *evs, int count, cairo_t *cairo)
+{
+    (void) ctx;
+    (void) cairo;
+
+    _seen.calls++;
+    if(evs->type == WKE_BEGIN) {
+        _seen.begins += count;
+        return WKR_FINISH; /* 0, must not hold it */
+    }
+
+    int take = _seen.take < 0 ? count : min(_seen.take, count);
+    _seen.pointers += take;
+    return take;
+}
+
+static int _expect(const char *what, int got, int want)
+{
+    if(got == want)
+        return 0;
+    fprintf(stderr, "%s: %d, expected %d\n", what, got, want);
+    return 1;
+}
+
+static void _enqueue(struct wk_context *ctx, int type)
+{
+    struct wk_event ev = { .type = type };
+    wk_event_enqueue(ctx, &ev);
+}
+
+int main(void)
+{
+    struct wk_display disp = { .loop = wk_loop_create() };
+    struct wk_window win = { .disp = &disp };
+    struct wk_context ctx = { .win = &win, .batch = _batch };
+    int failed = 0;
+
+    wk_event_ring_init(&ctx.queue, WK_EVENT_RING, WKQ_DROP_OLDEST);
+
+    /* What wk_window_context() queues, then input before the first frame */
+    _enqueue(&ctx, WKE_BEGIN);
+    for(int i = 0; i < TEST_POINTERS; i++)
+        _enqueue(&ctx, WKE_POINTER);
+
+    _seen.take = -1;
+    _dispatch_context(&ctx);
+    failed |= _expect("begin events", _seen.begins, 1);
+    failed |= _expect("pointer events", _seen.pointers, TEST_POINTERS);
+    failed |= _expect("held after the first frame", ctx.held_count, 0);
+
+    /* A batch leaving events holds them without asking for more frames */
+    for(int i = 0; i < TEST_POINTERS; i++)
+        _enqueue(&ctx, WKE_POINTER);
+    _seen.take = 0;
+    _dispatch_context(&ctx);
+    failed |= _expect("held when nothing taken", ctx.held_count, TEST_POINTERS);
+
+    atomic_store(&win.dirty, false);
+    _dispatch_context(&ctx);
+    failed |= _expect("invalidated without progress", atomic_load(&win.dirty), false);
+
+    _seen.take = -1;
+    _dispatch_context(&ctx);
+    failed |= _expect("pointer events once taken", _seen.pointers, 2 * TEST_POINTERS);
+    failed |= _expect("held once taken", ctx.held_count, 0);
+    failed |= _expect("begin events at the end", _seen.begins, 1);
+
+    wk_event_ring_free(&ctx.queue);
+    free(win.batch);
+    printf("batch dispatch %s\n", failed ? "FAILED" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
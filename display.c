@@ -1,29 +1,76 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <poll.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
 #include <wayland-client.h>
 #include "xdg-shell-unstable-v6.h"
+#include "presentation-time.h"
+#include "viewporter.h"
 #include "util.h"
 #include "event.h"
+#include "shm.h"
+#include "worker.h"
+#include "pixel.h"
+#include "loop.h"
+#include "slab.h"
 
 #include "display.h"
 
-/* Used to send our own events to poll() */
-int pipefd[2];
+/* Output and format lists, a few small nodes per display */
+static struct wk_slab _monitor_slab = WK_SLAB_INIT(struct wk_monitor);
+static struct wk_slab _mode_slab = WK_SLAB_INIT(struct wk_mode);
+static struct wk_slab _format_slab = WK_SLAB_INIT(struct wk_format);
 
-static void _handle_signal(int signum)
+/* Signals that end the main loop, taken through a signalfd */
+static void _handle_signal(struct wk_source *src, uint32_t events, void *data)
 {
-    uint8_t ev;
+    struct wk_display *disp = data;
+    struct signalfd_siginfo info;
 
-    switch(signum) {
-        case SIGINT:
-            ev = KE_BRK;
-            break;
+    if(read(src->fd, &info, sizeof(info)) != sizeof(info))
+        return;
+
+    vlog("caught signal %d", info.ssi_signo);
+    disp->quit = true;
+}
+
+/* Wayland socket readable, or writable again after an EAGAIN flush.
+ * Events are only read here, each queue is dispatched by its owner */
+static void _handle_wayland(struct wk_source *src, uint32_t events, void *data)
+{
+    struct wk_display *disp = data;
+
+    if(events & EPOLLIN) {
+        disp->reading = false;
+        if(wl_display_read_events(disp->display) == -1) {
+            nlog(red("wl_display_read_events error"));
+            disp->quit = true;
+        }
+        return;
     }
 
-    write(pipefd[1], &ev, sizeof(uint8_t));
+    /* Loop is closing and we have no new data */
+    if(events & (EPOLLERR | EPOLLHUP))
+        disp->quit = true;
+}
+
+/* Send out our requests, waiting for EPOLLOUT when the socket is full
+ * instead of dropping the rest of the flush on the floor */
+static bool _flush(struct wk_display *disp)
+{
+    int ret = wl_display_flush(disp->display);
+    if(ret < 0 && errno != EAGAIN) {
+        nlog(red("wl_display_flush error"));
+        return false;
+    }
+
+    uint32_t events = EPOLLIN;
+    if(ret < 0)
+        events |= EPOLLOUT;
+    wk_loop_set_events(disp->loop, disp->wl_source, events);
+    return true;
 }
 
 /* wl_output listener */
@@ -33,7 +80,7 @@ static void _handle_geometry(void *data, struct wl_output *wl_output,
         int32_t transform)
 {
     struct wk_display *disp = data;
-    struct wk_monitor *new_mon = fzalloc(sizeof(struct wk_monitor));
+    struct wk_monitor *new_mon = failsafe(wk_slab_alloc(&_monitor_slab));
 
     new_mon->x = x;
     new_mon->y = y;
@@ -53,7 +100,7 @@ static void _handle_mode(void *data, struct wl_output *wl_output, uint32_t flags
         int32_t width, int32_t height, int32_t refresh)
 {
     struct wk_display *disp = data;
-    struct wk_mode *new_mode = fzalloc(sizeof(struct wk_mode));
+    struct wk_mode *new_mode = failsafe(wk_slab_alloc(&_mode_slab));
 
     new_mode->width = width;
     new_mode->height = height;
@@ -90,6 +137,36 @@ struct wl_output_listener output_listener = {
 /* end wl_output listener */
 
 
+/* wl_shm listener */
+static void _handle_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+    struct wk_display *disp = data;
+    struct wk_format *fmt = failsafe(wk_slab_alloc(&_format_slab));
+
+    /* Push to the top of the format list */
+    fmt->value = format;
+    fmt->next = disp->format_head;
+    disp->format_head = fmt;
+}
+
+struct wl_shm_listener shm_listener = {
+    .format = _handle_format
+};
+/* end wl_shm listener */
+
+/* wp_presentation listener */
+static void _handle_clock_id(void *data, struct wp_presentation *wp_presentation,
+        uint32_t clk_id)
+{
+    struct wk_display *disp = data;
+    disp->clock = clk_id;
+}
+
+struct wp_presentation_listener presentation_listener = {
+    .clock_id = _handle_clock_id
+};
+/* end wp_presentation listener */
+
 /* wl_registry listerner */
 static void _handle_global(void *data, struct wl_registry *registry,
         uint32_t name, const char *interface, uint32_t version)
@@ -99,15 +176,29 @@ static void _handle_global(void *data, struct wl_registry *registry,
     struct wk_display *disp = data;
     /* Cycle through the interfaces we need */
     if(strcmp(interface, wl_compositor_interface.name) == 0) {
-        disp->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, min(3, version));
+        disp->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, min(4, version));
+    } else if(strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        /* Optional, only contexts on their own surfaces use it */
+        disp->subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, min(1, version));
     } else if(strcmp(interface, wl_shm_interface.name) == 0) {
         disp->shm = wl_registry_bind(registry, name, &wl_shm_interface, min(1, version));
+        /* Formats follow the bind, listen before they arrive */
+        wl_shm_add_listener(disp->shm, &shm_listener, disp);
     } else if(strcmp(interface, wl_seat_interface.name) == 0) {
-        disp->seat = wl_registry_bind(registry, name, &wl_seat_interface, min(4, version));
+        disp->seat = wl_registry_bind(registry, name, &wl_seat_interface, min(5, version));
     } else if(strcmp(interface, wl_output_interface.name) == 0) {
         disp->output = wl_registry_bind(registry, name, &wl_output_interface, min(2, version));
+        /* Modes follow the bind too, pacing and scaling need the refresh */
+        wl_output_add_listener(disp->output, &output_listener, disp);
     } else if(strcmp(interface, zxdg_shell_v6_interface.name) == 0) {
         disp->shell = wl_registry_bind(registry, name, &zxdg_shell_v6_interface, min(1, version));
+    } else if(strcmp(interface, wp_viewporter_interface.name) == 0) {
+        /* Optional, only scaled windows use it */
+        disp->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, min(1, version));
+    } else if(strcmp(interface, wp_presentation_interface.name) == 0) {
+        /* Optional, only frame timing uses it */
+        disp->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, min(1, version));
+        wp_presentation_add_listener(disp->presentation, &presentation_listener, disp);
     }
 
     /* Just add more interfaces here */
@@ -138,21 +229,27 @@ struct zxdg_shell_v6_listener shell_listener = {
 };
 /* end zxdg_shell listener */
 
-struct wk_display *wk_display_connect()
+/* Set up a display over an established connection */
+static struct wk_display *_connect(struct wl_display *display)
 {
     struct wk_display* disp = fzalloc(sizeof(struct wk_display));
+    disp->clock = CLOCK_MONOTONIC;
     nlog("Connecting to display");
+    wk_pixel_init();
 
-    /* Used for handling our own events in the loop */
-    if(pipe(pipefd) < 0) {
-        nlog(red("Failed to pipe()"));
-        exit(EXIT_FAILURE);
-    }
-    signal(SIGINT, _handle_signal);
+    /* Blocked before any thread starts so they all inherit it, the loop
+     * reads them from a signalfd instead */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
+    disp->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(disp->sigfd < 0)
+        failsafe(0); /* No signalfd */
 
-    /* Connect to display. NULL is the default "wayland-0" */
-    disp->display = failsafe(wl_display_connect("wayland-0"));
+    disp->display = display;
     disp->registry = wl_display_get_registry(disp->display);
 
     /* Attach the listener and send the display as data */
@@ -166,88 +263,111 @@ struct wk_display *wk_display_connect()
     failsafe(disp->seat);
     failsafe(disp->output);
 
-    wl_output_add_listener(disp->output, &output_listener, disp);
+    disp->pool = wk_shm_pool_create(disp->shm, WK_SHM_POOL_SIZE);
+
     zxdg_shell_v6_add_listener(disp->shell, &shell_listener, disp);
 
+    disp->loop = wk_loop_create();
+    disp->wl_source = wk_loop_add_fd(disp->loop, wl_display_get_fd(disp->display),
+            EPOLLIN, _handle_wayland, disp);
+    wk_loop_add_fd(disp->loop, disp->sigfd, EPOLLIN, _handle_signal, disp);
+
     return disp;
 }
 
-void wk_display_main(struct wk_display* disp)
+/* Connect to $WAYLAND_DISPLAY, or the socket handed down in
+ * $WAYLAND_SOCKET, falling back to "wayland-0" */
+struct wk_display *wk_display_connect()
 {
-    struct pollfd pfd[2];
-    int ret, num;
+    return _connect(failsafe(wl_display_connect(NULL)));
+}
 
-    /* The display fd is first */
-    pfd[0].fd = wl_display_get_fd(disp->display);
-    pfd[0].events = POLLIN | POLLERR | POLLHUP;
+/* Connect over an already connected socket, e.g. one end of a
+ * socketpair() whose other end a headless compositor serves */
+struct wk_display *wk_display_connect_fd(int fd)
+{
+    return _connect(failsafe(wl_display_connect_to_fd(fd)));
+}
 
-    /* Our events go second */
-    pfd[1].fd = pipefd[0];
-    pfd[1].events = POLLIN;
+void wk_display_main(struct wk_display* disp)
+{
+    disp->quit = false;
 
     /* Entering main loop */
-    while(1) {
-        wl_display_dispatch_pending(disp->display);
-        ret = wl_display_flush(disp->display);
-        if(ret < 0 && errno != EAGAIN) {
-            nlog(red("wl_display_flush error"));
+    while(!disp->quit) {
+        /* The default queue has the seat, the shell and the registry */
+        while(wl_display_prepare_read(disp->display) != 0)
+            wl_display_dispatch_pending(disp->display);
+        disp->reading = true;
+
+        /* Wayland, signals, wakeups and the caller's fds and timers */
+        int ret = _flush(disp) ? wk_loop_dispatch(disp->loop, -1) : -1;
+        bool read = !disp->reading;
+        if(!read)
+            wl_display_cancel_read(disp->display);
+        if(ret < 0) {
+            nlog(red("main loop error"));
             break;
         }
 
-        num = poll(&pfd[0], 2, -1);
-        if((num < 0) && (errno != EINTR)) {
-            nlog(red("poll error"));
-            break;
-        }
+        wl_display_dispatch_pending(disp->display);
 
-        if(num > 0) {
-            uint32_t wevent = pfd[0].revents;
-            uint32_t kevent = pfd[1].revents;
-
-            /* Handle our events after wayland's */
-            if((kevent & POLLIN) && !(wevent & POLLIN)) {
-                uint8_t event;
-                read(pipefd[0], &event, sizeof(uint8_t));
-
-                bool exit;
-
-                switch(event) {
-                    case KE_BRK:
-                        exit = true;
-                        break;
-                }
-
-                if(exit)
-                    break;
-            }
-
-            /* Loop is closing and we have no new data */
-            if(((wevent & POLLERR) || (wevent & POLLHUP)) && !(wevent & POLLIN))
-                break;
-
-            if(wevent & POLLIN) {
-                ret = wl_display_dispatch(disp->display);
-                if(ret == -1) {
-                    nlog(red("wl_display_dispatch error"));
-                    break;
-                }
-            }
-
-            /* Render only once we've dealt with all events */
-            if(!disp->window->buffer->busy) {
-                wk_window_render(disp->window);
-            }
+        /* Windows with a thread handle their queue there. The others are
+         * rendered here once every event was dealt with, and only when
+         * something changed and the last frame was shown */
+        for(struct wk_window *win = disp->window_head; win != NULL; win = win->next) {
+            if(win->threaded) {
+                if(read)
+                    wk_window_wake(win);
+            } else
+                wk_window_dispatch(win);
         }
     }
     /* Exiting main loop */
 }
 
+/* Make wk_display_main() return, from any thread */
+void wk_display_quit(struct wk_display *disp)
+{
+    disp->quit = true;
+    wk_loop_wakeup(disp->loop);
+}
+
+/* True when the compositor takes wl_shm buffers in format */
+bool wk_display_has_format(struct wk_display *disp, uint32_t format)
+{
+    for(struct wk_format *fmt = disp->format_head; fmt != NULL; fmt = fmt->next) {
+        if(fmt->value == format)
+            return true;
+    }
+    return false;
+}
+
+/* Draw contexts on count extra threads, 0 draws on the loop thread only */
+void wk_display_set_workers(struct wk_display *disp, int count)
+{
+    if(disp->workers)
+        wk_workers_destroy(disp->workers);
+
+    disp->workers = count > 0 ? wk_workers_create(count) : NULL;
+}
+
 void wk_display_disconnect(struct wk_display* disp)
 {
+    wk_display_set_workers(disp, 0);
+    wk_event_finish(disp);
+
     /* Free the wayland interfaces */
+    wk_shm_pool_destroy(disp->pool);
     wl_compositor_destroy(disp->compositor);
+    if(disp->subcompositor)
+        wl_subcompositor_destroy(disp->subcompositor);
     wl_shm_destroy(disp->shm);
     zxdg_shell_v6_destroy(disp->shell);
+    if(disp->presentation)
+        wp_presentation_destroy(disp->presentation);
+    if(disp->viewporter)
+        wp_viewporter_destroy(disp->viewporter);
     wl_seat_destroy(disp->seat);
     wl_output_destroy(disp->output);
 
@@ -260,18 +380,30 @@ void wk_display_disconnect(struct wk_display* disp)
     while(mon_head != NULL) {
         struct wk_monitor* to_del = mon_head;
         mon_head = mon_head->next;
-        free(to_del);
+        wk_slab_free(&_monitor_slab, to_del);
+    }
+
+    struct wk_format* fmt_head = disp->format_head;
+    while(fmt_head != NULL) {
+        struct wk_format* to_del = fmt_head;
+        fmt_head = fmt_head->next;
+        wk_slab_free(&_format_slab, to_del);
     }
 
     struct wk_mode* mode_head = disp->mode_head;
     while(mode_head != NULL) {
         struct wk_mode* to_del = mode_head;
         mode_head = mode_head->next;
-        free(to_del);
+        wk_slab_free(&_mode_slab, to_del);
     }
 
-    close(pipefd[0]);
-    close(pipefd[1]);
+    /* The last display gives the pages back */
+    wk_slab_trim(&_monitor_slab);
+    wk_slab_trim(&_format_slab);
+    wk_slab_trim(&_mode_slab);
+
+    wk_loop_destroy(disp->loop);
+    close(disp->sigfd);
 
     free(disp);
 }
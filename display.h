@@ -4,11 +4,13 @@
 #include <stdint.h>
 #include <wayland-client.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "window.h"
-
-/* Events sent wk_display_emit() */
-#define KE_BRK  0
+#include "shm.h"
+#include "worker.h"
+#include "loop.h"
 
 /* Modes are found by the mode event of wl_ouput_listener */
 struct wk_mode {
@@ -39,6 +41,14 @@ struct wk_monitor {
     struct wk_monitor *next;
 };
 
+/* Formats are found by the format event of wl_shm_listener */
+struct wk_format {
+    uint32_t value;
+
+    /* Next format in list */
+    struct wk_format *next;
+};
+
 /* Main structure */
 struct wk_display {
     /* Wayland objects */
@@ -47,10 +57,30 @@ struct wk_display {
 
     /* Wayland interfaces (see on_reg_global) */
     struct wl_compositor* compositor;
+    struct wl_subcompositor* subcompositor;
     struct wl_shm* shm;
     struct wl_seat* seat;
     struct wl_output* output;
 
+    /* Seat input, see event.c */
+    struct wk_pointer *pointer;
+
+    /* Shared by every buffer of the display's windows */
+    struct wk_shm_pool *pool;
+    struct wk_format *format_head;
+
+    /* Optional threads drawing contexts in parallel */
+    struct wk_workers *workers;
+
+    /* Main loop, callers add their own fds and timers to it */
+    struct wk_loop *loop;
+    struct wk_source *wl_source;
+    int sigfd;
+    atomic_bool quit;
+
+    /* Between wl_display_prepare_read() and reading or cancelling */
+    bool reading;
+
     /* wl_output lists */
     struct wk_monitor *mon_head;
     struct wk_mode *mode_head;
@@ -60,14 +90,25 @@ struct wk_display {
     /* xdg_shell */
     struct zxdg_shell_v6 *shell;
 
-    /* The display's window */
-    // TODO: Enable support for multiple windows (i.e. create list here)
-    struct wk_window *window;
+    /* wp_presentation if the compositor has it, and the clock of its
+     * timestamps which frame timing uses throughout */
+    struct wp_presentation *presentation;
+    clockid_t clock;
+
+    /* wp_viewporter if the compositor has it, for WKW_SCALING */
+    struct wp_viewporter *viewporter;
+
+    /* The display's windows, newest first */
+    struct wk_window *window_head;
 };
 
 /* Functions */
 struct wk_display *wk_display_connect();
+struct wk_display *wk_display_connect_fd(int fd);
 void wk_display_main(struct wk_display *disp);
+void wk_display_quit(struct wk_display *disp);
+void wk_display_set_workers(struct wk_display *disp, int count);
+bool wk_display_has_format(struct wk_display *disp, uint32_t format);
 void wk_display_disconnect(struct wk_display *disp);
 
 #endif /* WK_DISPLAY_H */
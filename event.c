@@ -1,102 +1,639 @@
+#include <sched.h>
+#include <string.h>
+#include <wayland-client.h>
 #include "util.h"
+#include "slab.h"
 #include "event.h"
 
-struct wl_pointer *pointer;
+/*
+ * Event rings follow Vyukov's bounded queue: slot i is free for the
+ * producer at position p when seq == p, and holds an event for the
+ * consumer when seq == p + 1. Dropping the oldest event claims it like
+ * the consumer would, through the tail CAS. Coalescing briefly locks
+ * the newest slot by setting seq back to its position.
+ *
+ * Slots are taken from shared pools on the first push, doubled while the
+ * ring is full and below its capacity, and handed back once the
+ * consumer found it empty WK_EVENT_RING_IDLE times in a row. The pools
+ * keep their pages until the last window is destroyed. Both sides count themselves in users while they
+ * touch the slots, and swapping them takes users from 1 (the swapper
+ * alone) to -1. Only the producer waits for that, the consumer gives up
+ * if the producer is inside.
+ */
 
-/* Enqueue an event in the context */
-void wk_event_enqueue(struct wk_context *ctx, struct wk_event *ev)
+/* Slot arrays of WK_EVENT_RING_MIN << i slots */
+#define _SLOTS(n) WK_SLAB_SIZED((n) * sizeof(struct wk_event_slot))
+static struct wk_slab _pools[] = {
+    _SLOTS(4), _SLOTS(8), _SLOTS(16), _SLOTS(32), _SLOTS(64), _SLOTS(128), _SLOTS(256)
+};
+
+static struct wk_slab *_pool(uint32_t size)
 {
-    if(ctx->queue_enq >= WK_MAX_EVENTS)
-        failsafe(0); /* Too many events! */
+    if(size > WK_EVENT_POOL_MAX)
+        return NULL;
 
-    ctx->queue[ctx->queue_enq] = ev;
-    ctx->queue_enq++;
+    int i = 0;
+    while((WK_EVENT_RING_MIN << i) < size)
+        i++;
+    return &_pools[i];
 }
 
-/* Dequeue an event in the context */
-void wk_event_dequeue(struct wk_context *ctx, struct wk_event *out)
+static struct wk_event_slot *_slots_alloc(uint32_t size)
 {
-    /* If we're out of events, just return */
-    if(ctx->queue_deq >= ctx->queue_enq)
-        return;
+    struct wk_slab *pool = _pool(size);
+    if(pool)
+        return failsafe(wk_slab_alloc(pool));
+    return fzalloc(size * sizeof(struct wk_event_slot));
+}
+
+static void _slots_free(struct wk_event_slot *slots, uint32_t size)
+{
+    struct wk_slab *pool = _pool(size);
+    if(pool)
+        wk_slab_free(pool, slots);
+    else
+        free(slots);
+}
+
+static void _ring_enter(struct wk_event_ring *ring)
+{
+    int users = atomic_load(&ring->users);
+    while(users < 0 || !atomic_compare_exchange_weak(&ring->users, &users, users + 1)) {
+        if(users < 0) {
+            sched_yield();
+            users = atomic_load(&ring->users);
+        }
+    }
+}
+
+static void _ring_leave(struct wk_event_ring *ring)
+{
+    atomic_fetch_sub(&ring->users, 1);
+}
+
+/* Be the only thread inside, with wait until the other one leaves */
+static bool _ring_lock(struct wk_event_ring *ring, bool wait)
+{
+    int alone = 1;
+    while(!atomic_compare_exchange_weak(&ring->users, &alone, -1)) {
+        if(!wait && alone != 1)
+            return false;
+        alone = 1;
+        sched_yield();
+    }
+    return true;
+}
+
+static void _ring_unlock(struct wk_event_ring *ring)
+{
+    atomic_store(&ring->users, 1);
+}
+
+/* Move the pending events to size slots, none for 0. Called locked */
+static void _ring_resize(struct wk_event_ring *ring, uint32_t size)
+{
+    uint32_t tail = atomic_load(&ring->tail);
+    uint32_t head = atomic_load(&ring->head);
+    struct wk_event_slot *slots = size ? _slots_alloc(size) : NULL;
+
+    /* Positions tail to tail + size cover every slot once, the pending
+     * ones hold an event and the rest are free for the producer */
+    for(uint32_t pos = tail; size && pos != tail + size; pos++) {
+        struct wk_event_slot *slot = &slots[pos & (size - 1)];
+        if((int32_t) (pos - head) < 0) {
+            slot->ev = ring->slots[pos & ring->mask].ev;
+            atomic_init(&slot->seq, pos + 1);
+        } else {
+            atomic_init(&slot->seq, pos);
+        }
+    }
+
+    if(ring->slots)
+        _slots_free(ring->slots, ring->mask + 1);
+    ring->slots = slots;
+    ring->mask = size ? size - 1 : 0;
+}
+
+void wk_event_ring_init(struct wk_event_ring *ring, uint32_t capacity, int policy)
+{
+    /* A power of two, and two slots at least so coalescing never
+     * touches the slot being read */
+    uint32_t size = 2;
+    while(size < capacity)
+        size <<= 1;
+
+    ring->slots = NULL;
+    ring->mask = 0;
+    ring->capacity = size;
+    ring->policy = policy;
+    ring->has_consumer = false;
+    ring->idle = 0;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->users, 0);
+    atomic_init(&ring->high_water, 0);
+    atomic_init(&ring->drops, 0);
+    atomic_init(&ring->coalesced, 0);
+    atomic_init(&ring->blocks, 0);
+}
+
+void wk_event_ring_free(struct wk_event_ring *ring)
+{
+    if(ring->slots)
+        _slots_free(ring->slots, ring->mask + 1);
+    ring->slots = NULL;
+    ring->mask = 0;
+}
+
+/* Take the oldest event out, used by the consumer and by drop-oldest */
+static bool _ring_take(struct wk_event_ring *ring, struct wk_event *out)
+{
+    uint32_t pos = atomic_load(&ring->tail);
+    struct wk_event_slot *slot;
+
+    while(1) {
+        slot = &ring->slots[pos & ring->mask];
+        int32_t diff = (int32_t) (atomic_load(&slot->seq) - (pos + 1));
+
+        if(diff == 0) {
+            /* Published, try to claim it (pos is reloaded on failure) */
+            if(atomic_compare_exchange_weak(&ring->tail, &pos, pos + 1))
+                break;
+        } else if(diff < 0) {
+            /* Empty, or the producer is coalescing into it */
+            if(atomic_load(&ring->head) == pos)
+                return false;
+            sched_yield();
+        } else {
+            /* Someone else claimed it first */
+            pos = atomic_load(&ring->tail);
+        }
+    }
+
+    /* Copy it out once nobody is coalescing into it, then free it */
+    uint32_t published = pos + 1;
+    while(1) {
+        if(atomic_load(&slot->seq) == published) {
+            *out = slot->ev;
+            if(atomic_compare_exchange_strong(&slot->seq, &published,
+                        pos + ring->mask + 1))
+                return true;
+        }
+        published = pos + 1;
+        sched_yield();
+    }
+}
+
+/* Fold ev into the newest pending event if it has the same type */
+static bool _ring_coalesce(struct wk_event_ring *ring, uint32_t head,
+        const struct wk_event *ev)
+{
+    uint32_t last = head - 1;
+    uint32_t published = head;
+    struct wk_event_slot *slot = &ring->slots[last & ring->mask];
+
+    /* Lock it, this fails if the consumer already freed it */
+    if(!atomic_compare_exchange_strong(&slot->seq, &published, last))
+        return false;
+
+    /* Claimed by the consumer before we locked it, leave it alone */
+    bool merge = (int32_t) (atomic_load(&ring->tail) - last) <= 0 &&
+        slot->ev.type == ev->type;
+    if(merge) {
+        slot->ev.repeat += ev->repeat + 1;
+        slot->ev.data = ev->data;
+    }
+
+    atomic_store(&slot->seq, head);
+    return merge;
+}
+
+/* Push an event, false if the ring was full and something was lost */
+bool wk_event_ring_push(struct wk_event_ring *ring, const struct wk_event *ev)
+{
+    _ring_enter(ring);
+    if(!ring->slots) {
+        _ring_lock(ring, true);
+        _ring_resize(ring, min(WK_EVENT_RING_MIN, ring->capacity));
+        _ring_unlock(ring);
+    }
+
+    uint32_t pos = atomic_load(&ring->head);
+    struct wk_event_slot *slot = &ring->slots[pos & ring->mask];
+    struct wk_event old;
+    bool blocked = false;
+    bool lost = false;
+
+    while(atomic_load(&slot->seq) != pos) {
+        /* The consumer claimed a slot and is still copying it out */
+        if(pos - atomic_load(&ring->tail) <= ring->mask) {
+            sched_yield();
+            continue;
+        }
+
+        /* Full, but it may grow */
+        if(ring->mask + 1 < ring->capacity) {
+            _ring_lock(ring, true);
+            _ring_resize(ring, (ring->mask + 1) * 2);
+            _ring_unlock(ring);
+            slot = &ring->slots[pos & ring->mask];
+            continue;
+        }
+
+        int policy = ring->policy;
+        if(policy == WKQ_BLOCK && ring->has_consumer &&
+                pthread_equal(ring->consumer, pthread_self()))
+            policy = WKQ_DROP_OLDEST; /* Would wait for ourselves */
+
+        switch(policy) {
+            case WKQ_COALESCE:
+                if(_ring_coalesce(ring, pos, ev)) {
+                    atomic_fetch_add(&ring->coalesced, 1);
+                    return true;
+                }
+                /* Fall through, nothing to merge with */
+            case WKQ_DROP_OLDEST:
+                if(_ring_take(ring, &old)) {
+                    atomic_fetch_add(&ring->drops, 1);
+                    lost = true;
+                }
+                break;
+            case WKQ_BLOCK:
+                if(!blocked)
+                    atomic_fetch_add(&ring->blocks, 1);
+                blocked = true;
+                sched_yield();
+                break;
+        }
+    }
+
+    slot->ev = *ev;
+    atomic_store(&slot->seq, pos + 1);
+    atomic_store(&ring->head, pos + 1);
+    _ring_leave(ring);
+
+    uint32_t depth = pos + 1 - atomic_load(&ring->tail);
+    if(depth > atomic_load(&ring->high_water))
+        atomic_store(&ring->high_water, depth);
+
+    return !lost;
+}
+
+/* Pop the oldest event, false if there was none */
+bool wk_event_ring_pop(struct wk_event_ring *ring, struct wk_event *out)
+{
+    ring->consumer = pthread_self();
+    ring->has_consumer = true;
+
+    _ring_enter(ring);
+    bool ret = ring->slots && _ring_take(ring, out);
+
+    /* Idle for a while, the slots go back to the pool unless the
+     * producer is busy */
+    if(ret)
+        ring->idle = 0;
+    else if(ring->slots && ++ring->idle >= WK_EVENT_RING_IDLE &&
+            _ring_lock(ring, false)) {
+        if(atomic_load(&ring->head) == atomic_load(&ring->tail)) {
+            _ring_resize(ring, 0);
+            ring->idle = 0;
+        }
+        _ring_unlock(ring);
+    }
+
+    _ring_leave(ring);
+    return ret;
+}
+
+/* Number of pending events, a snapshot when other threads are active */
+uint32_t wk_event_ring_count(struct wk_event_ring *ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
 
-    out = ctx->queue[ctx->queue_deq];
-    ctx->queue_deq++;
+/* Resize the context's queue and set its overflow policy, pending
+ * events are lost so do this before producers start */
+void wk_context_set_queue(struct wk_context *ctx, uint32_t capacity, int policy)
+{
+    wk_event_ring_free(&ctx->queue);
+    wk_event_ring_init(&ctx->queue, capacity, policy);
+}
+
+/* Enqueue an event in the context, false if an event was lost */
+bool wk_event_enqueue(struct wk_context *ctx, struct wk_event *ev)
+{
+    bool ret = wk_event_ring_push(&ctx->queue, ev);
+
+    /* Events are delivered on the next frame */
+    wk_window_invalidate(ctx->win);
+    return ret;
 }
 
-/* Reset the context's event queue */
+/* Dequeue an event in the context, false if there was none */
+bool wk_event_dequeue(struct wk_context *ctx, struct wk_event *out)
+{
+    return wk_event_ring_pop(&ctx->queue, out);
+}
+
+/* Drop every pending event of the context */
 void wk_event_rsqueue(struct wk_context *ctx)
 {
-    /* Set the top and bottom pointer back to 0 */
-    ctx->queue_enq = 0;
-    ctx->queue_deq = 0;
+    struct wk_event ev;
+    while(wk_event_ring_pop(&ctx->queue, &ev))
+        ;
+}
+
+/* Record a raw event, frames keep the range they span */
+static void _record_raw(struct wk_pointer *ptr, int type, uint32_t time,
+        double x, double y, uint32_t button, uint32_t state, double value)
+{
+    struct wk_pointer_raw *raw = &ptr->raw[ptr->raw_seq % WK_POINTER_HISTORY];
+
+    raw->type = type;
+    raw->time = time;
+    raw->x = x;
+    raw->y = y;
+    raw->button = button;
+    raw->state = state;
+    raw->value = value;
+
+    ptr->raw_seq++;
+    ptr->frame.raw_last = ptr->raw_seq;
+}
+
+/* Read back raw event seq, false once it fell out of the history */
+bool wk_pointer_raw(struct wk_display *disp, uint64_t seq, struct wk_pointer_raw *out)
+{
+    struct wk_pointer *ptr = disp->pointer;
+
+    if(!ptr || seq >= ptr->raw_seq || ptr->raw_seq - seq > WK_POINTER_HISTORY)
+        return false;
+
+    *out = ptr->raw[seq % WK_POINTER_HISTORY];
+    return true;
+}
+
+static void _send_frame(struct wk_context *ctx, struct wk_pointer_frame *frame)
+{
+    struct wk_event ev = { .type = WKE_POINTER, .pointer = *frame };
+
+    ev.pointer.x -= ctx->x;
+    ev.pointer.y -= ctx->y;
+    wk_event_enqueue(ctx, &ev);
+}
+
+/* Deliver what was collected since the last frame, one event per context */
+static void _flush_frame(struct wk_pointer *ptr)
+{
+    struct wk_pointer_frame *frame = &ptr->frame;
+    if(!frame->mask)
+        return;
+
+    pthread_mutex_lock(&ptr->lock);
+    struct wk_context *target = ptr->grab;
+    if(!target && ptr->focus) {
+        pthread_mutex_lock(&ptr->focus->lock);
+        target = wk_grid_at(&ptr->focus->grid, ptr->x, ptr->y);
+        pthread_mutex_unlock(&ptr->focus->lock);
+    }
+
+    frame->x = ptr->x;
+    frame->y = ptr->y;
+
+    /* Crossing contexts, the old one only hears that we left */
+    if(target != ptr->hover) {
+        if(ptr->hover) {
+            struct wk_pointer_frame leave = *frame;
+            leave.mask = WKP_LEAVE;
+            _send_frame(ptr->hover, &leave);
+        }
+
+        frame->mask &= ~WKP_LEAVE;
+        frame->mask |= WKP_ENTER;
+        ptr->hover = target;
+    }
+
+    if(target && frame->mask & ~WKP_LEAVE)
+        _send_frame(target, frame);
+
+    /* Buttons held keep sending to the context they were pressed on */
+    for(int i = 0; i < frame->nbuttons; i++) {
+        if(frame->states[i] == WL_POINTER_BUTTON_STATE_PRESSED)
+            ptr->pressed++;
+        else if(ptr->pressed > 0)
+            ptr->pressed--;
+    }
+    ptr->grab = ptr->pressed > 0 ? target : NULL;
+
+    pthread_mutex_unlock(&ptr->lock);
+
+    memset(frame, 0, sizeof(struct wk_pointer_frame));
+    frame->raw_first = frame->raw_last = ptr->raw_seq;
 }
 
-void _handle_enter(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+/* Before wl_pointer v5 there are no frame events, every event is one */
+static void _end_event(struct wk_pointer *ptr)
+{
+    if(wl_pointer_get_version(ptr->wl_pointer) < WL_POINTER_FRAME_SINCE_VERSION)
+        _flush_frame(ptr);
+}
+
+static void _handle_enter(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
         struct wl_surface *surface, wl_fixed_t surface_x, wl_fixed_t surface_y)
 {
-    // TODO: Check that there is a context there and send them the event
+    struct wk_pointer *ptr = data;
+
+    pthread_mutex_lock(&ptr->lock);
+    ptr->focus = surface ? wl_surface_get_user_data(surface) : NULL;
+    ptr->origin_x = ptr->origin_y = 0;
+    if(ptr->focus)
+        wk_window_surface_origin(ptr->focus, surface, &ptr->origin_x, &ptr->origin_y);
+    pthread_mutex_unlock(&ptr->lock);
+    ptr->x = wl_fixed_to_double(surface_x) + ptr->origin_x;
+    ptr->y = wl_fixed_to_double(surface_y) + ptr->origin_y;
+    ptr->frame.serial = serial;
+    ptr->frame.mask |= WKP_ENTER;
+
+    _record_raw(ptr, WKP_ENTER, 0, ptr->x, ptr->y, 0, 0, 0);
+    _end_event(ptr);
 }
 
-void _handle_leave(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+static void _handle_leave(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
         struct wl_surface *surface)
 {
+    struct wk_pointer *ptr = data;
 
+    pthread_mutex_lock(&ptr->lock);
+    ptr->focus = NULL;
+    ptr->grab = NULL;
+    ptr->pressed = 0;
+    pthread_mutex_unlock(&ptr->lock);
+    ptr->frame.serial = serial;
+    ptr->frame.mask |= WKP_LEAVE;
+
+    _record_raw(ptr, WKP_LEAVE, 0, ptr->x, ptr->y, 0, 0, 0);
+    _end_event(ptr);
 }
 
-void _handle_motion(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+static void _handle_motion(void *data, struct wl_pointer *wl_pointer, uint32_t time,
         wl_fixed_t surface_x, wl_fixed_t surface_y)
 {
+    struct wk_pointer *ptr = data;
+    double x = wl_fixed_to_double(surface_x) + ptr->origin_x;
+    double y = wl_fixed_to_double(surface_y) + ptr->origin_y;
+
+    /* Consecutive motions collapse into one position and delta */
+    ptr->frame.dx += x - ptr->x;
+    ptr->frame.dy += y - ptr->y;
+    ptr->frame.motions++;
+    ptr->frame.time = time;
+    ptr->frame.mask |= WKP_MOTION;
+    ptr->x = x;
+    ptr->y = y;
 
+    _record_raw(ptr, WKP_MOTION, time, x, y, 0, 0, 0);
+    _end_event(ptr);
 }
 
-void _handle_button(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+static void _handle_button(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
         uint32_t time, uint32_t button, uint32_t state)
 {
+    struct wk_pointer *ptr = data;
+    struct wk_pointer_frame *frame = &ptr->frame;
+
+    /* A frame this busy is unheard of, keep the latest change */
+    int i = min(frame->nbuttons, WK_FRAME_BUTTONS - 1);
+    frame->buttons[i] = button;
+    frame->states[i] = state;
+    frame->nbuttons = i + 1;
+
+    frame->serial = serial;
+    frame->time = time;
+    frame->mask |= WKP_BUTTON;
 
+    _record_raw(ptr, WKP_BUTTON, time, ptr->x, ptr->y, button, state, 0);
+    _end_event(ptr);
 }
 
-void _handle_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+static void _handle_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
         uint32_t axis, wl_fixed_t value)
 {
+    struct wk_pointer *ptr = data;
 
+    if(axis <= WL_POINTER_AXIS_HORIZONTAL_SCROLL)
+        ptr->frame.axis[axis] += wl_fixed_to_double(value);
+    ptr->frame.time = time;
+    ptr->frame.mask |= WKP_AXIS;
+
+    _record_raw(ptr, WKP_AXIS, time, ptr->x, ptr->y, axis, 0,
+            wl_fixed_to_double(value));
+    _end_event(ptr);
 }
 
-void _handle_frame(void *data, struct wl_pointer *wl_pointer)
+static void _handle_frame(void *data, struct wl_pointer *wl_pointer)
 {
+    _flush_frame(data);
+}
+
+static void _handle_axis_source(void *data, struct wl_pointer *wl_pointer,
+        uint32_t axis_source)
+{
+}
 
+static void _handle_axis_stop(void *data, struct wl_pointer *wl_pointer,
+        uint32_t time, uint32_t axis)
+{
+}
+
+static void _handle_axis_discrete(void *data, struct wl_pointer *wl_pointer,
+        uint32_t axis, int32_t discrete)
+{
 }
 
-struct wl_pointer_listener pointer_listener {
+struct wl_pointer_listener pointer_listener = {
     .enter = _handle_enter,
     .leave = _handle_leave,
     .motion = _handle_motion,
     .button = _handle_button,
     .axis = _handle_axis,
     .frame = _handle_frame,
+    .axis_source = _handle_axis_source,
+    .axis_stop = _handle_axis_stop,
+    .axis_discrete = _handle_axis_discrete
 };
 
 static void _handle_capabilities(void *data, struct wl_seat *wl_seat,
         uint32_t caps)
 {
-    if((caps & WL_SEAT_CAPABILITY_POINTER) && !pointer) {
-        pointer = wl_seat_get_pointer(seat);
-        wl_pointer_add_listener(pointer, &pointer_listener, NULL);
-        vlog("Pointer found!");
-    } else if(!(caps & WL_SEAT_CAPABILITY_POINTER) && pointer) {
-        wl_pointer_destroy(pointer);
-        pointer = NULL;
-        vlog("Pointer destroyed?!");
+    struct wk_display *disp = data;
+
+    if((caps & WL_SEAT_CAPABILITY_POINTER) && !disp->pointer) {
+        struct wk_pointer *ptr = fzalloc(sizeof(struct wk_pointer));
+        ptr->disp = disp;
+        ptr->wl_pointer = wl_seat_get_pointer(wl_seat);
+        pthread_mutex_init(&ptr->lock, NULL);
+        wl_pointer_add_listener(ptr->wl_pointer, &pointer_listener, ptr);
+        disp->pointer = ptr;
+        nlog("Pointer found!");
+    } else if(!(caps & WL_SEAT_CAPABILITY_POINTER) && disp->pointer) {
+        wl_pointer_destroy(disp->pointer->wl_pointer);
+        pthread_mutex_destroy(&disp->pointer->lock);
+        free(disp->pointer);
+        disp->pointer = NULL;
+        nlog("Pointer destroyed?!");
     }
 }
 
-struct wl_seat_listener seat_listener {
-    .capabilities = _handle_capabilites,
-    .name = NULL
+static void _handle_name(void *data, struct wl_seat *wl_seat, const char *name)
+{
+}
+
+struct wl_seat_listener seat_listener = {
+    .capabilities = _handle_capabilities,
+    .name = _handle_name
 };
 
+/* Stop pointing at a context (or a whole window when ctx is NULL) */
+void wk_event_forget(struct wk_display *disp, struct wk_window *win,
+        struct wk_context *ctx)
+{
+    struct wk_pointer *ptr = disp->pointer;
+    if(!ptr)
+        return;
+
+    pthread_mutex_lock(&ptr->lock);
+    if(ptr->hover && (ptr->hover == ctx || (!ctx && ptr->hover->win == win)))
+        ptr->hover = NULL;
+    if(ptr->grab && (ptr->grab == ctx || (!ctx && ptr->grab->win == win)))
+        ptr->grab = NULL;
+    if(!ctx && ptr->focus == win)
+        ptr->focus = NULL;
+    pthread_mutex_unlock(&ptr->lock);
+}
+
 void wk_event_prepare(struct wk_display *disp)
 {
     failsafe(disp->seat);
-    wl_seat_add_listener(seat, &seat_listener, NULL);
+    wl_seat_add_listener(disp->seat, &seat_listener, disp);
+}
+
+/* Give the slot pools' pages back, if no ring holds slots */
+void wk_event_trim(void)
+{
+    for(size_t i = 0; i < sizeof(_pools) / sizeof(_pools[0]); i++)
+        wk_slab_trim(&_pools[i]);
+}
+
+void wk_event_finish(struct wk_display *disp)
+{
+    wk_event_trim();
+
+    if(!disp->pointer)
+        return;
+
+    wl_pointer_destroy(disp->pointer->wl_pointer);
+    pthread_mutex_destroy(&disp->pointer->lock);
+    free(disp->pointer);
+    disp->pointer = NULL;
 }
@@ -1,53 +1,253 @@
 #ifndef WK_EVENT_H
 #define WK_EVENT_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <cairo/cairo.h>
-#include "display.h"
-#include "window.h"
 
-#define WK_MAX_EVENTS   500
+struct wk_event;
+struct wk_display;
+struct wk_context;
 
+/* Declared before the includes so window.h can see it. cairo is only
+ * set for WKE_DRAW, where it is clipped to the damaged area */
 typedef int (*wk_context_func)(struct wk_context *ctx,
         struct wk_event *ev, cairo_t *cairo);
 
+/* Batch variant, see wk_context_set_batch(). Gets a run of count
+ * consecutive pending events of one type, oldest first, and returns how
+ * many it handled. Runs keep the queue order, so events of one type
+ * split by another come in separate calls. The rest come back first on
+ * the next render, which they only ask for if it took some or more came
+ * in. WKE_BEGIN, WKE_END and WKE_DRAW come one at a time and what it
+ * returns for them is ignored */
+typedef int (*wk_context_batch_func)(struct wk_context *ctx,
+        struct wk_event *evs, int count, cairo_t *cairo);
+
+#include "display.h"
+#include "window.h"
+#include "region.h"
+#include "hist.h"
+
+/* Default capacity of a context's event ring */
+#define WK_EVENT_RING   64
+
+/* Slots a ring starts with on its first event, it doubles from there up
+ * to its capacity. Slot arrays up to WK_EVENT_POOL_MAX come from shared
+ * pools, see event.c */
+#define WK_EVENT_RING_MIN   4
+#define WK_EVENT_POOL_MAX   256
+
+/* Dequeues in a row that find a ring empty before its slots go back to
+ * the pools, so a context getting events every frame keeps them */
+#define WK_EVENT_RING_IDLE  8
+
+/* Buttons kept per pointer frame, and raw pointer events kept around */
+#define WK_FRAME_BUTTONS    4
+#define WK_POINTER_HISTORY  256
+
+/* What changed in a wk_pointer_frame, also the type of wk_pointer_raw */
+#define WKP_ENTER       (1 << 0)
+#define WKP_LEAVE       (1 << 1)
+#define WKP_MOTION      (1 << 2)
+#define WKP_BUTTON      (1 << 3)
+#define WKP_AXIS        (1 << 4)
+
+/* Everything a context got from the pointer within one wl_pointer.frame */
+struct wk_pointer_frame {
+    uint32_t mask;
+    uint32_t time;
+    uint32_t serial;
+
+    /* Final position in context coordinates, and motion merged */
+    double x, y;
+    double dx, dy;
+    int motions;
+
+    /* Scroll merged, indexed by wl_pointer axis */
+    double axis[2];
+
+    int nbuttons;
+    uint32_t buttons[WK_FRAME_BUTTONS];
+    uint32_t states[WK_FRAME_BUTTONS];
+
+    /* Raw events [raw_first, raw_last), see wk_pointer_raw() */
+    uint64_t raw_first, raw_last;
+};
+
+/* A wl_pointer event as the compositor sent it */
+struct wk_pointer_raw {
+    int type;
+    uint32_t time;
+    double x, y;        /* Surface coordinates, enter and motion */
+    uint32_t button;    /* Button, or axis for WKP_AXIS */
+    uint32_t state;
+    double value;       /* Axis value */
+};
+
+/* Pointer of the display's seat */
+struct wk_pointer {
+    struct wl_pointer *wl_pointer;
+    struct wk_display *disp;
+
+    /* Taken while delivering a frame, windows on their own threads
+     * forget contexts under it */
+    pthread_mutex_t lock;
+
+    /* Window under the pointer, and the context the last frame went to */
+    struct wk_window *focus;
+    struct wk_context *hover;
+    /* Context getting everything while a button is held */
+    struct wk_context *grab;
+    int pressed;
+
+    /* Window coordinates, and those of the entered surface's origin
+     * when it belongs to a context with its own */
+    double x, y;
+    int origin_x, origin_y;
+
+    /* Frame being collected, in surface coordinates until delivered */
+    struct wk_pointer_frame frame;
+
+    /* Raw event history */
+    uint64_t raw_seq;
+    struct wk_pointer_raw raw[WK_POINTER_HISTORY];
+};
+
 struct wk_event {
     struct wk_event *prev;
 
     int repeat;
     int type;
     void *data;
-}
+
+    /* Set for WKE_POINTER */
+    struct wk_pointer_frame pointer;
+};
+
+/* A ring slot, seq tells whose turn it is (see event.c) */
+struct wk_event_slot {
+    _Atomic uint32_t seq;
+    struct wk_event ev;
+};
+
+/* Single producer, single consumer ring of events. Slots are only
+ * there while events come in, see WK_EVENT_RING_IDLE */
+struct wk_event_ring {
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    uint32_t mask;
+    uint32_t capacity;
+    int policy;
+    struct wk_event_slot *slots;
+
+    /* Threads inside the ring, -1 while one of them swaps the slots */
+    _Atomic int users;
+
+    /* Last thread to dequeue, WKQ_BLOCK never waits on itself */
+    pthread_t consumer;
+    bool has_consumer;
+
+    /* Dequeues in a row that found it empty, the consumer's own */
+    uint32_t idle;
+
+    /* Counters */
+    _Atomic uint32_t high_water;
+    _Atomic uint64_t drops;
+    _Atomic uint64_t coalesced;
+    _Atomic uint64_t blocks;
+};
 
 struct wk_context {
     struct wk_window  *win;
     struct wk_context *prev;
     struct wk_context *next;
     wk_context_func callback;
+    wk_context_batch_func batch;
+
+    /* Events the batch function left for the next frame */
+    struct wk_event *held;
+    int held_count;
 
-    cairo_surface_t surface;
-    cairo_t cairo;
+    /* Bound to the window buffer with the id buffer_id */
+    cairo_surface_t *surface;
+    cairo_t *cairo;
+    uint32_t buffer_id;
 
-    int queue_enq, queue_deq;
-    struct wk_event queue[WK_MAX_EVENTS];
+    struct wk_event_ring queue;
 
     int layer, x, y, width, height, retcode;
-}
 
-void wk_event_enqueue(struct wk_context *ctx, struct wk_event *in);
-void wk_event_dequeue(struct wk_context *ctx, struct wk_event *out);
+    /* Scale of the target it draws into, below 1 with WKW_SCALING. Cairo
+     * applies it, callbacks only look at it to skip detail */
+    double scale;
+
+    /* Paints all of its rectangle opaque, see wk_context_set_opaque() */
+    bool opaque;
+
+    /* Display list of a retained context, recorded is cleared by
+     * invalidating, see wk_context_set_retained() */
+    bool retained;
+    cairo_surface_t *list;
+    atomic_bool recorded;
+
+    /* Render worker wave and clip, see _run_draws() */
+    int wave;
+    struct wk_region *clip;
+
+    /* Layer cache we draw into with WKW_COMPOSITE */
+    struct wk_layer *cache;
+
+    /* Own surface, see wk_context_set_subsurface */
+    struct wk_plane *plane;
+
+    /* Callback draw times with WKW_TIMING */
+    struct wk_hist *timing;
+
+    /* Stacking order within a layer, and where the grid indexed us */
+    uint64_t order;
+    bool grid_indexed;
+    int grid_x0, grid_y0, grid_x1, grid_y1;
+    uint32_t grid_mark;
+};
+
+void wk_event_ring_init(struct wk_event_ring *ring, uint32_t capacity, int policy);
+bool wk_event_ring_push(struct wk_event_ring *ring, const struct wk_event *ev);
+bool wk_event_ring_pop(struct wk_event_ring *ring, struct wk_event *out);
+uint32_t wk_event_ring_count(struct wk_event_ring *ring);
+void wk_event_ring_free(struct wk_event_ring *ring);
+
+void wk_context_set_queue(struct wk_context *ctx, uint32_t capacity, int policy);
+bool wk_event_enqueue(struct wk_context *ctx, struct wk_event *in);
+bool wk_event_dequeue(struct wk_context *ctx, struct wk_event *out);
 void wk_event_rsqueue(struct wk_context *ctx);
+void wk_event_trim(void);
+
+bool wk_pointer_raw(struct wk_display *disp, uint64_t seq, struct wk_pointer_raw *out);
+void wk_event_forget(struct wk_display *disp, struct wk_window *win,
+        struct wk_context *ctx);
 
 void wk_event_prepare(struct wk_display *disp);
+void wk_event_finish(struct wk_display *disp);
 
 /* wk_context_func return values */
 
 #define WKR_FINISH      0
 #define WKR_RECALL      1
 
+/* What a full ring does with a new event */
+
+#define WKQ_DROP_OLDEST 0 /* Discard the oldest pending event */
+#define WKQ_COALESCE    1 /* Fold into the newest event of the same type */
+#define WKQ_BLOCK       2 /* Wait for a consumer running on another thread */
+
 /* wk_event types */
 
 #define WKE_BEGIN       0 /* Called when context is first created */
 #define WKE_END         1 /* Called when context is destroyed */
-/* #define WKE_MOUSECLK 2 Called when mouse clicked, wip */
+#define WKE_DRAW        2 /* Called when the context must be repainted */
+#define WKE_POINTER     3 /* One per pointer frame, see wk_pointer_frame */
 
 #endif
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "event.h"
+
+#include "grid.h"
+
+/* True when a is drawn above b */
+static inline bool _above(struct wk_context *a, struct wk_context *b)
+{
+    return a->layer > b->layer || (a->layer == b->layer && a->order > b->order);
+}
+
+static int _compare_order(const void *pa, const void *pb)
+{
+    struct wk_context *a = *(struct wk_context * const *) pa;
+    struct wk_context *b = *(struct wk_context * const *) pb;
+
+    if(a == b)
+        return 0;
+    return _above(a, b) ? 1 : -1;
+}
+
+/* Cells covered by ctx, false if it lies outside the grid */
+static bool _cell_range(struct wk_grid *grid, int x, int y, int width, int height,
+        int *x0, int *y0, int *x1, int *y1)
+{
+    if(width <= 0 || height <= 0 || x + width <= 0 || y + height <= 0)
+        return false;
+
+    *x0 = max(x, 0) / WK_GRID_CELL;
+    *y0 = max(y, 0) / WK_GRID_CELL;
+    *x1 = min((x + width - 1) / WK_GRID_CELL, grid->cols - 1);
+    *y1 = min((y + height - 1) / WK_GRID_CELL, grid->rows - 1);
+    return *x0 <= *x1 && *y0 <= *y1;
+}
+
+void wk_grid_init(struct wk_grid *grid, int width, int height)
+{
+    grid->width = width;
+    grid->height = height;
+    grid->cols = max(1, (width + WK_GRID_CELL - 1) / WK_GRID_CELL);
+    grid->rows = max(1, (height + WK_GRID_CELL - 1) / WK_GRID_CELL);
+    grid->cells = fzalloc(grid->cols * grid->rows * sizeof(struct wk_grid_cell));
+}
+
+/* Resize the grid to a new window size and index the list again */
+void wk_grid_rebuild(struct wk_grid *grid, int width, int height,
+        struct wk_context *head)
+{
+    int cols = max(1, (width + WK_GRID_CELL - 1) / WK_GRID_CELL);
+    int rows = max(1, (height + WK_GRID_CELL - 1) / WK_GRID_CELL);
+
+    if(cols != grid->cols || rows != grid->rows) {
+        for(int i = 0; i < grid->cols * grid->rows; i++)
+            free(grid->cells[i].ctx);
+        free(grid->cells);
+
+        grid->cols = cols;
+        grid->rows = rows;
+        grid->cells = fzalloc(cols * rows * sizeof(struct wk_grid_cell));
+    } else {
+        for(int i = 0; i < cols * rows; i++)
+            grid->cells[i].count = 0;
+    }
+
+    grid->width = width;
+    grid->height = height;
+
+    for(struct wk_context *ctx = head; ctx != NULL; ctx = ctx->next)
+        wk_grid_insert(grid, ctx);
+}
+
+void wk_grid_insert(struct wk_grid *grid, struct wk_context *ctx)
+{
+    int x0, y0, x1, y1;
+
+    ctx->grid_indexed = _cell_range(grid, ctx->x, ctx->y, ctx->width, ctx->height,
+            &x0, &y0, &x1, &y1);
+    if(!ctx->grid_indexed)
+        return;
+
+    for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1; x++) {
+            struct wk_grid_cell *cell = &grid->cells[y * grid->cols + x];
+            if(cell->count == cell->cap) {
+                cell->cap = max(4, cell->cap * 2);
+                cell->ctx = failsafe(realloc(cell->ctx,
+                            cell->cap * sizeof(struct wk_context *)));
+            }
+            cell->ctx[cell->count++] = ctx;
+        }
+    }
+
+    /* Remember where it went in case it moves before removal */
+    ctx->grid_x0 = x0;
+    ctx->grid_y0 = y0;
+    ctx->grid_x1 = x1;
+    ctx->grid_y1 = y1;
+}
+
+void wk_grid_remove(struct wk_grid *grid, struct wk_context *ctx)
+{
+    if(!ctx->grid_indexed)
+        return;
+
+    for(int y = ctx->grid_y0; y <= ctx->grid_y1; y++) {
+        for(int x = ctx->grid_x0; x <= ctx->grid_x1; x++) {
+            struct wk_grid_cell *cell = &grid->cells[y * grid->cols + x];
+            for(int i = 0; i < cell->count; i++) {
+                if(cell->ctx[i] == ctx) {
+                    cell->ctx[i] = cell->ctx[--cell->count];
+                    break;
+                }
+            }
+        }
+    }
+
+    ctx->grid_indexed = false;
+}
+
+/* Topmost context containing (x, y), in window coordinates */
+struct wk_context *wk_grid_at(struct wk_grid *grid, double x, double y)
+{
+    if(x < 0 || y < 0)
+        return NULL;
+
+    int cx = x / WK_GRID_CELL;
+    int cy = y / WK_GRID_CELL;
+    if(cx >= grid->cols || cy >= grid->rows)
+        return NULL;
+
+    struct wk_grid_cell *cell = &grid->cells[cy * grid->cols + cx];
+    struct wk_context *hit = NULL;
+
+    for(int i = 0; i < cell->count; i++) {
+        struct wk_context *ctx = cell->ctx[i];
+        if(x >= ctx->x && x < ctx->x + ctx->width &&
+                y >= ctx->y && y < ctx->y + ctx->height &&
+                (!hit || _above(ctx, hit)))
+            hit = ctx;
+    }
+    return hit;
+}
+
+/* Contexts intersecting the region, sorted bottom to top */
+int wk_grid_query(struct wk_grid *grid, const struct wk_region *reg,
+        struct wk_context ***out)
+{
+    int count = 0;
+    grid->mark++;
+
+    for(int r = 0; r < reg->count; r++) {
+        const struct wk_rect *rect = &reg->rects[r];
+        int x0, y0, x1, y1;
+
+        if(!_cell_range(grid, rect->x, rect->y, rect->width, rect->height,
+                    &x0, &y0, &x1, &y1))
+            continue;
+
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                struct wk_grid_cell *cell = &grid->cells[y * grid->cols + x];
+
+                for(int i = 0; i < cell->count; i++) {
+                    struct wk_context *ctx = cell->ctx[i];
+                    struct wk_rect bounds = { ctx->x, ctx->y, ctx->width, ctx->height };
+
+                    if(ctx->grid_mark == grid->mark ||
+                            !wk_region_intersects(reg, &bounds))
+                        continue;
+                    ctx->grid_mark = grid->mark;
+
+                    if(count == grid->result_cap) {
+                        grid->result_cap = max(16, grid->result_cap * 2);
+                        grid->result = failsafe(realloc(grid->result,
+                                    grid->result_cap * sizeof(struct wk_context *)));
+                    }
+                    grid->result[count++] = ctx;
+                }
+            }
+        }
+    }
+
+    qsort(grid->result, count, sizeof(struct wk_context *), _compare_order);
+    *out = grid->result;
+    return count;
+}
+
+void wk_grid_free(struct wk_grid *grid)
+{
+    for(int i = 0; i < grid->cols * grid->rows; i++)
+        free(grid->cells[i].ctx);
+    free(grid->cells);
+    free(grid->result);
+    memset(grid, 0, sizeof(struct wk_grid));
+}
@@ -0,0 +1,43 @@
+#ifndef WK_GRID_H
+#define WK_GRID_H
+
+#include <stdint.h>
+#include "region.h"
+
+struct wk_context;
+
+/* Side of a grid cell in pixels */
+#define WK_GRID_CELL    64
+
+/* Contexts overlapping one cell, in no particular order */
+struct wk_grid_cell {
+    struct wk_context **ctx;
+    int count, cap;
+};
+
+/* Uniform grid over a window's contexts */
+struct wk_grid {
+    int width, height;
+    int cols, rows;
+    struct wk_grid_cell *cells;
+
+    /* Stamp telling which contexts a query already returned */
+    uint32_t mark;
+
+    /* Query results, valid until the next query */
+    struct wk_context **result;
+    int result_cap;
+};
+
+/* Functions */
+void wk_grid_init(struct wk_grid *grid, int width, int height);
+void wk_grid_rebuild(struct wk_grid *grid, int width, int height,
+        struct wk_context *head);
+void wk_grid_insert(struct wk_grid *grid, struct wk_context *ctx);
+void wk_grid_remove(struct wk_grid *grid, struct wk_context *ctx);
+struct wk_context *wk_grid_at(struct wk_grid *grid, double x, double y);
+int wk_grid_query(struct wk_grid *grid, const struct wk_region *reg,
+        struct wk_context ***out);
+void wk_grid_free(struct wk_grid *grid);
+
+#endif /* WK_GRID_H */
@@ -0,0 +1,83 @@
+#include <string.h>
+#include <time.h>
+#include "util.h"
+
+#include "hist.h"
+
+/* Values below WK_HIST_SUB get a bucket each, above that bucket group g
+ * covers [2^(g + 3), 2^(g + 4)) in WK_HIST_SUB steps */
+static int _bucket(uint64_t value)
+{
+    if(value < WK_HIST_SUB)
+        return value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int group = msb - WK_HIST_SUB_BITS + 1;
+    int shift = group - 1;
+    if(group >= WK_HIST_RANGE)
+        return WK_HIST_BUCKETS - 1;
+
+    return group * WK_HIST_SUB + (int) (value >> shift) - WK_HIST_SUB;
+}
+
+/* Highest value that lands in the bucket */
+static uint64_t _bucket_value(int bucket)
+{
+    int group = bucket / WK_HIST_SUB;
+    if(group == 0)
+        return bucket;
+
+    int shift = group - 1;
+    uint64_t sub = bucket % WK_HIST_SUB + WK_HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t wk_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void wk_hist_clear(struct wk_hist *hist)
+{
+    memset(hist, 0, sizeof(struct wk_hist));
+}
+
+void wk_hist_record(struct wk_hist *hist, uint64_t value)
+{
+    hist->buckets[_bucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+    hist->max = max(hist->max, value);
+}
+
+/* Smallest recorded value at or above percent of them, 0 when empty */
+uint64_t wk_hist_percentile(const struct wk_hist *hist, double percent)
+{
+    if(hist->count == 0)
+        return 0;
+
+    uint64_t rank = (percent / 100.0) * hist->count + 0.5;
+    rank = max(rank, 1);
+
+    uint64_t seen = 0;
+    for(int i = 0; i < WK_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if(seen >= rank)
+            return min(_bucket_value(i), hist->max);
+    }
+    return hist->max;
+}
+
+/* One line of count, mean, p50, p99 and max, in microseconds */
+void wk_hist_print(const struct wk_hist *hist, const char *name, FILE *out)
+{
+    double mean = hist->count ? (double) hist->sum / hist->count : 0;
+
+    fprintf(out, "%-24s n=%-8llu mean=%.1f p50=%.1f p99=%.1f max=%.1f us\n",
+            name, (unsigned long long) hist->count, mean / 1000,
+            wk_hist_percentile(hist, 50) / 1000.0,
+            wk_hist_percentile(hist, 99) / 1000.0,
+            hist->max / 1000.0);
+}
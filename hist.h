@@ -0,0 +1,34 @@
+#ifndef WK_HIST_H
+#define WK_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Each power of two is split in 2^WK_HIST_SUB_BITS buckets, so a bucket
+ * is within about 6% of the values it holds */
+#define WK_HIST_SUB_BITS    4
+#define WK_HIST_SUB         (1 << WK_HIST_SUB_BITS)
+
+/* Powers of two covered, values past 2^(WK_HIST_RANGE + 3) land in the
+ * last bucket. In nanoseconds that is about 2 hours */
+#define WK_HIST_RANGE       40
+#define WK_HIST_BUCKETS     (WK_HIST_RANGE * WK_HIST_SUB)
+
+/* Fixed size log-linear histogram, recording is a couple of shifts */
+struct wk_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[WK_HIST_BUCKETS];
+};
+
+/* Functions */
+uint64_t wk_clock_ns(clockid_t clock);
+
+void wk_hist_clear(struct wk_hist *hist);
+void wk_hist_record(struct wk_hist *hist, uint64_t value);
+uint64_t wk_hist_percentile(const struct wk_hist *hist, double percent);
+void wk_hist_print(const struct wk_hist *hist, const char *name, FILE *out);
+
+#endif /* WK_HIST_H */
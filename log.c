@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "util.h"
+
+#include "log.h"
+
+/* Every ring, and the lock taken to format them */
+static struct wk_log_ring *_ring_head;
+static pthread_mutex_t _ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+static uint64_t _start;
+
+static __thread struct wk_log_ring *_ring;
+
+/* Frees the ring of an exiting thread */
+static pthread_key_t _ring_key;
+
+/* Wakes the flusher when a ring it had emptied gets a record */
+static int _wakefd = -1;
+
+/* Flushed on before dying */
+static const int _fatal[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+static const char *_levels[] = { "debug", "info", "warn", "error" };
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Length of the conversion at fmt (just past the '%'), and what kind of
+ * argument it takes: 'i', 'u', 'd'ouble, 's'tring, 'p'ointer or 0 */
+static int _spec(const char *fmt, char *kind, int *length)
+{
+    int n = 0;
+    *length = 0;
+
+    while(fmt[n] && strchr("-+ #0123456789.*", fmt[n]))
+        n++;
+    while(fmt[n] && strchr("hlLqjzt", fmt[n])) {
+        if(fmt[n] == 'l' || fmt[n] == 'L' || fmt[n] == 'j' || fmt[n] == 'z' ||
+                fmt[n] == 't' || fmt[n] == 'q')
+            (*length)++;
+        n++;
+    }
+
+    switch(fmt[n]) {
+        case 'd': case 'i': case 'c':
+            *kind = 'i';
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            *kind = 'u';
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *kind = 'd';
+            break;
+        case 's':
+            *kind = 's';
+            break;
+        case 'p':
+            *kind = 'p';
+            break;
+        default:
+            *kind = 0;
+            break;
+    }
+
+    return fmt[n] ? n + 1 : n;
+}
+
+/* Pull the arguments the format reads into the record */
+static void _pack(struct wk_log_record *rec, const char *fmt, va_list ap)
+{
+    size_t text = 0;
+    rec->nargs = 0;
+
+    for(const char *c = fmt; *c; c++) {
+        if(*c != '%')
+            continue;
+        if(c[1] == '%') {
+            c++;
+            continue;
+        }
+
+        char kind;
+        int length;
+        int n = _spec(c + 1, &kind, &length);
+
+        /* '*' widths and precisions come first, as ints */
+        for(int i = 1; i <= n; i++) {
+            if(c[i] == '*' && rec->nargs < WK_LOG_ARGS)
+                rec->args[rec->nargs++].i = va_arg(ap, int);
+        }
+
+        if(rec->nargs == WK_LOG_ARGS)
+            break;
+        union wk_log_arg *arg = &rec->args[rec->nargs++];
+
+        switch(kind) {
+            case 'i':
+                arg->i = length >= 2 ? va_arg(ap, long long) :
+                    length == 1 ? va_arg(ap, long) : va_arg(ap, int);
+                break;
+            case 'u':
+                arg->u = length >= 2 ? va_arg(ap, unsigned long long) :
+                    length == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                break;
+            case 'd':
+                arg->d = c[n - 1] == 'L' ? (double) va_arg(ap, long double) : va_arg(ap, double);
+                break;
+            case 'p':
+                arg->p = va_arg(ap, void *);
+                break;
+            case 's': {
+                /* The string may be gone by the time it is formatted */
+                const char *str = va_arg(ap, const char *);
+                if(!str)
+                    str = "(null)";
+                size_t len = min(strlen(str), WK_LOG_TEXT - 1 - text);
+                memcpy(rec->text + text, str, len);
+                rec->text[text + len] = '\0';
+                arg->u = text;
+                text = min(text + len + 1, WK_LOG_TEXT - 1);
+                break;
+            }
+            default:
+                rec->nargs--;
+                break;
+        }
+
+        c += n;
+    }
+}
+
+/* Print the record the way printf would have */
+static void _format(struct wk_log_record *rec, FILE *out)
+{
+    double at = (rec->time - _start) / 1e9;
+    fprintf(out, "[%10.6f] %-5s ", at, _levels[rec->level]);
+
+    int next = 0;
+    for(const char *c = rec->fmt; *c; c++) {
+        if(*c != '%') {
+            fputc(*c, out);
+            continue;
+        }
+        if(c[1] == '%') {
+            fputc('%', out);
+            c++;
+            continue;
+        }
+
+        char kind;
+        int length;
+        int n = _spec(c + 1, &kind, &length);
+
+        /* Rebuild the conversion with '*' replaced by what was passed */
+        char spec[64];
+        int len = 0;
+        for(int i = 0; i <= n && len < 40; i++) {
+            if(c[i] == '*' && next < rec->nargs)
+                len += snprintf(spec + len, sizeof(spec) - len, "%d",
+                        (int) rec->args[next++].i);
+            else if(c[i] != '*')
+                spec[len++] = c[i];
+        }
+        spec[len] = '\0';
+        c += n;
+
+        if(!kind || next >= rec->nargs)
+            continue;
+        union wk_log_arg *arg = &rec->args[next++];
+
+        switch(kind) {
+            case 'i':
+                if(length >= 2) fprintf(out, spec, (long long) arg->i);
+                else if(length == 1) fprintf(out, spec, (long) arg->i);
+                else fprintf(out, spec, (int) arg->i);
+                break;
+            case 'u':
+                if(length >= 2) fprintf(out, spec, (unsigned long long) arg->u);
+                else if(length == 1) fprintf(out, spec, (unsigned long) arg->u);
+                else fprintf(out, spec, (unsigned int) arg->u);
+                break;
+            case 'd':
+                if(spec[len - 2] == 'L') fprintf(out, spec, (long double) arg->d);
+                else fprintf(out, spec, arg->d);
+                break;
+            case 'p':
+                fprintf(out, spec, arg->p);
+                break;
+            case 's':
+                fprintf(out, spec, rec->text + arg->u);
+                break;
+        }
+    }
+
+    fputc('\n', out);
+}
+
+/* Format what the ring holds, callers hold _ring_lock. True when more
+ * was logged meanwhile */
+static bool _drain_ring(struct wk_log_ring *ring)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    for(; tail != head; tail++)
+        _format(&ring->records[tail % WK_LOG_RING], stderr);
+
+    /* Sequentially consistent with the producer, either we see its new
+     * head or it sees the ring emptied and wakes us, see _wk_log() */
+    atomic_store(&ring->tail, tail);
+
+    uint64_t drops = atomic_exchange(&ring->drops, 0);
+    if(drops)
+        fprintf(stderr, "[log] %llu records dropped\n", (unsigned long long) drops);
+
+    return atomic_load(&ring->head) != tail;
+}
+
+/* Format everything logged so far, callers hold _ring_lock */
+static bool _drain(void)
+{
+    bool pending = false;
+
+    for(struct wk_log_ring *ring = _ring_head; ring != NULL; ring = ring->next)
+        pending |= _drain_ring(ring);
+    fflush(stderr);
+    return pending;
+}
+
+/* Sleeps until something is logged, then lets records gather for
+ * WK_LOG_PERIOD and formats them. Idle, it never wakes up */
+static void *_flusher_main(void *data)
+{
+    struct timespec period = { 0, WK_LOG_PERIOD * 1000000 };
+    bool pending = false;
+    (void) data;
+
+    while(1) {
+        /* Interrupted, wait again. Any other failure falls back to
+         * draining every WK_LOG_PERIOD */
+        uint64_t count;
+        while(!pending && _wakefd >= 0 &&
+                read(_wakefd, &count, sizeof(uint64_t)) < 0 && errno == EINTR)
+            ;
+        nanosleep(&period, NULL);
+
+        pthread_mutex_lock(&_ring_lock);
+        pending = _drain();
+        pthread_mutex_unlock(&_ring_lock);
+    }
+    return NULL;
+}
+
+/* A thread exits, what it logged is formatted and its ring freed */
+static void _release_ring(void *data)
+{
+    struct wk_log_ring *ring = data;
+
+    pthread_mutex_lock(&_ring_lock);
+    _drain_ring(ring);
+    fflush(stderr);
+    for(struct wk_log_ring **link = &_ring_head; *link != NULL; link = &(*link)->next) {
+        if(*link == ring) {
+            *link = ring->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_ring_lock);
+
+    _ring = NULL;
+    free(ring);
+}
+
+/* Crashing, get the log out before dying. Formatting isn't async-signal
+ * safe, but losing what led to the crash is worse. A thread that died
+ * holding the lock gets 100 ms to be noticed before we give up */
+static void _handle_fatal(int sig)
+{
+    struct timespec wait = { 0, 1000000 };
+    int tries = 100;
+
+    while(pthread_mutex_trylock(&_ring_lock) != 0 && --tries > 0)
+        nanosleep(&wait, NULL);
+    if(tries > 0) {
+        _drain();
+        pthread_mutex_unlock(&_ring_lock);
+    }
+
+    /* The handler was reset, this time it kills us */
+    raise(sig);
+}
+
+static void _start_flusher(void)
+{
+    pthread_t thread;
+
+    _start = _now();
+    atexit(wk_log_flush);
+    pthread_key_create(&_ring_key, _release_ring);
+    _wakefd = eventfd(0, EFD_CLOEXEC);
+
+    /* Only where nobody installed their own handler */
+    struct sigaction act = { .sa_handler = _handle_fatal, .sa_flags = SA_RESETHAND };
+    sigemptyset(&act.sa_mask);
+    for(size_t i = 0; i < sizeof(_fatal) / sizeof(int); i++) {
+        struct sigaction old;
+        if(sigaction(_fatal[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+            sigaction(_fatal[i], &act, NULL);
+    }
+
+    if(pthread_create(&thread, NULL, _flusher_main, NULL) == 0)
+        pthread_detach(thread);
+}
+
+/* Callers may be logging a failure, errno stays theirs. The eventfd
+ * blocks, so there is no EAGAIN, only a write that would take the
+ * counter to its 2^64 - 1 limit waits */
+static void _wake_flusher(void)
+{
+    uint64_t one = 1;
+    int saved = errno;
+
+    while(write(_wakefd, &one, sizeof(uint64_t)) < 0 && errno == EINTR)
+        ;
+    errno = saved;
+}
+
+/* Record a message on the calling thread's ring, never blocks */
+void _wk_log(int level, const char *fmt, ...)
+{
+    if(!_ring) {
+        pthread_once(&_once, _start_flusher);
+
+        struct wk_log_ring *ring = zalloc(sizeof(struct wk_log_ring));
+        if(!ring)
+            return;
+
+        pthread_mutex_lock(&_ring_lock);
+        ring->next = _ring_head;
+        _ring_head = ring;
+        pthread_mutex_unlock(&_ring_lock);
+        _ring = ring;
+        pthread_setspecific(_ring_key, ring);
+    }
+
+    uint64_t head = atomic_load_explicit(&_ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&_ring->tail, memory_order_acquire);
+    if(head - tail >= WK_LOG_RING) {
+        atomic_fetch_add_explicit(&_ring->drops, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct wk_log_record *rec = &_ring->records[head % WK_LOG_RING];
+    rec->fmt = fmt;
+    rec->time = _now();
+    rec->level = level;
+
+    va_list ap;
+    va_start(ap, fmt);
+    _pack(rec, fmt, ap);
+    va_end(ap);
+
+    atomic_store(&_ring->head, head + 1);
+
+    /* The flusher had emptied the ring and may be asleep */
+    if(atomic_load(&_ring->tail) == head && _wakefd >= 0)
+        _wake_flusher();
+}
+
+/* Format what every thread logged, also run at exit and by failsafe() */
+void wk_log_flush(void)
+{
+    pthread_mutex_lock(&_ring_lock);
+    _drain();
+    pthread_mutex_unlock(&_ring_lock);
+}
@@ -0,0 +1,74 @@
+#ifndef WK_LOG_H
+#define WK_LOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Levels, anything below WK_LOG_LEVEL is compiled out */
+#define WK_LOG_DEBUG    0
+#define WK_LOG_INFO     1
+#define WK_LOG_WARN     2
+#define WK_LOG_ERROR    3
+
+#ifndef WK_LOG_LEVEL
+#ifdef NDEBUG
+#define WK_LOG_LEVEL    WK_LOG_INFO
+#else
+#define WK_LOG_LEVEL    WK_LOG_DEBUG
+#endif
+#endif
+
+/* Records per thread ring, a full ring drops new records */
+#define WK_LOG_RING     512
+
+/* Arguments kept per record, and room for the strings among them */
+#define WK_LOG_ARGS     6
+#define WK_LOG_TEXT     64
+
+/* How long the flusher lets records gather once something was logged,
+ * in milliseconds. It sleeps while nothing is */
+#define WK_LOG_PERIOD   50
+
+/* Log a printf-style message. The format must be a literal, it is kept
+ * by address and only formatted by the flusher */
+#define wk_log(level, ...) do { \
+        if((level) >= WK_LOG_LEVEL) \
+            _wk_log(level, __VA_ARGS__); \
+    } while(0)
+
+union wk_log_arg {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+};
+
+/* One call to wk_log(), arguments packed as the format reads them */
+struct wk_log_record {
+    const char *fmt;
+    uint64_t time;
+    int level;
+    int nargs;
+    union wk_log_arg args[WK_LOG_ARGS];
+
+    /* %s arguments are copied here, args hold their offsets */
+    char text[WK_LOG_TEXT];
+};
+
+/* Single producer ring of one thread, drained by the flusher */
+struct wk_log_ring {
+    _Atomic uint64_t head;  /* Next record written, by the owning thread */
+    _Atomic uint64_t tail;  /* Next record formatted, by the flusher */
+    _Atomic uint64_t drops;
+    struct wk_log_record records[WK_LOG_RING];
+
+    /* Next ring, every live thread that logged has one */
+    struct wk_log_ring *next;
+};
+
+/* Functions */
+void _wk_log(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void wk_log_flush(void);
+
+#endif /* WK_LOG_H */
@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "util.h"
+
+#include "loop.h"
+
+/* Read an 8 byte counter off an eventfd or timerfd, false if there was
+ * none (EAGAIN) or the read failed */
+static bool _read_counter(int fd, uint64_t *count)
+{
+    ssize_t ret;
+    while((ret = read(fd, count, sizeof(uint64_t))) < 0 && errno == EINTR)
+        ;
+    return ret == sizeof(uint64_t);
+}
+
+/* Drain the wakeup counter, the loop returning is all it was for. It
+ * may already be drained, by a wakeup seen in an earlier batch */
+static void _handle_wake(struct wk_source *src, uint32_t events, void *data)
+{
+    uint64_t count;
+    if(!_read_counter(src->fd, &count) && errno != EAGAIN)
+        vlog("loop wakeup read failed, errno %d", errno);
+}
+
+struct wk_loop *wk_loop_create()
+{
+    struct wk_loop *loop = fzalloc(sizeof(struct wk_loop));
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epfd < 0)
+        failsafe(0); /* No epoll */
+
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(loop->wakefd < 0)
+        failsafe(0); /* No eventfd */
+
+    loop->wake = wk_loop_add_fd(loop, loop->wakefd, EPOLLIN, _handle_wake, NULL);
+    return loop;
+}
+
+/* Watch fd for events (EPOLLIN, EPOLLOUT, ...), the fd stays ours to close */
+struct wk_source *wk_loop_add_fd(struct wk_loop *loop, int fd, uint32_t events,
+        wk_source_func func, void *data)
+{
+    struct wk_source *src = fzalloc(sizeof(struct wk_source));
+    src->fd = fd;
+    src->events = events;
+    src->func = func;
+    src->data = data;
+
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        failsafe(0); /* Could not watch the fd */
+
+    /* Push to the top of the source list */
+    src->next = loop->source_head;
+    loop->source_head = src;
+    return src;
+}
+
+/* Change what the source waits for, e.g. EPOLLOUT while output is stuck */
+void wk_loop_set_events(struct wk_loop *loop, struct wk_source *src, uint32_t events)
+{
+    if(src->events == events)
+        return;
+
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_MOD, src->fd, &ev) < 0)
+        failsafe(0); /* Could not modify the fd */
+    src->events = events;
+}
+
+/* A monotonic timer firing after delay_ms, then every interval_ms unless
+ * it is 0. A delay of 0 leaves it disarmed */
+struct wk_source *wk_loop_add_timer(struct wk_loop *loop, uint32_t delay_ms,
+        uint32_t interval_ms, wk_source_func func, void *data)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0)
+        failsafe(0); /* No timerfd */
+
+    struct wk_source *src = wk_loop_add_fd(loop, fd, EPOLLIN, func, data);
+    src->timer = true;
+    wk_loop_set_timer(src, delay_ms, interval_ms);
+    return src;
+}
+
+/* Rearm a timer, see wk_loop_add_timer() */
+void wk_loop_set_timer(struct wk_source *src, uint32_t delay_ms, uint32_t interval_ms)
+{
+    wk_loop_set_timer_ns(src, delay_ms * 1000000ULL, interval_ms * 1000000ULL);
+}
+
+/* Rearm a timer with nanoseconds, for deadlines finer than milliseconds */
+void wk_loop_set_timer_ns(struct wk_source *src, uint64_t delay_ns, uint64_t interval_ns)
+{
+    struct itimerspec spec = {
+        .it_value = { delay_ns / 1000000000, delay_ns % 1000000000 },
+        .it_interval = { interval_ns / 1000000000, interval_ns % 1000000000 }
+    };
+
+    timerfd_settime(src->fd, 0, &spec, NULL);
+}
+
+/* Stop watching the source, safe from inside any source's callback */
+void wk_loop_remove(struct wk_loop *loop, struct wk_source *src)
+{
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if(src->timer)
+        close(src->fd);
+    src->removed = true;
+
+    struct wk_source **link = &loop->source_head;
+    while(*link != src)
+        link = &(*link)->next;
+    *link = src->next;
+
+    /* Events for it may still be in the batch being dispatched */
+    src->next = loop->dead_head;
+    loop->dead_head = src;
+}
+
+/* Make a running wk_loop_dispatch() return, from any thread */
+void wk_loop_wakeup(struct wk_loop *loop)
+{
+    uint64_t one = 1;
+    ssize_t ret;
+
+    /* EAGAIN is a full counter, the loop has a wakeup pending anyway */
+    while((ret = write(loop->wakefd, &one, sizeof(uint64_t))) < 0 && errno == EINTR)
+        ;
+    if(ret < 0 && errno != EAGAIN)
+        vlog("loop wakeup write failed, errno %d", errno);
+}
+
+/* Wait up to timeout ms (-1 forever) and run the callbacks of the ready
+ * sources. Returns how many were ready, -1 on error */
+int wk_loop_dispatch(struct wk_loop *loop, int timeout)
+{
+    struct epoll_event events[WK_LOOP_EVENTS];
+
+    int count = epoll_wait(loop->epfd, events, WK_LOOP_EVENTS, timeout);
+    if(count < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for(int i = 0; i < count; i++) {
+        struct wk_source *src = events[i].data.ptr;
+        if(src->removed)
+            continue;
+
+        /* Expirations are not counted, clear them so it stops firing.
+         * Nothing to read means it was rearmed since, and is not due */
+        if(src->timer) {
+            uint64_t expired;
+            if(!_read_counter(src->fd, &expired))
+                continue;
+        }
+
+        src->func(src, events[i].events, src->data);
+    }
+
+    while(loop->dead_head != NULL) {
+        struct wk_source *to_del = loop->dead_head;
+        loop->dead_head = to_del->next;
+        free(to_del);
+    }
+
+    return count;
+}
+
+void wk_loop_destroy(struct wk_loop *loop)
+{
+    while(loop->source_head != NULL)
+        wk_loop_remove(loop, loop->source_head);
+
+    while(loop->dead_head != NULL) {
+        struct wk_source *to_del = loop->dead_head;
+        loop->dead_head = to_del->next;
+        free(to_del);
+    }
+
+    close(loop->wakefd);
+    close(loop->epfd);
+    free(loop);
+}
@@ -0,0 +1,60 @@
+#ifndef WK_LOOP_H
+#define WK_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+
+/* Most epoll events handled per wk_loop_dispatch() */
+#define WK_LOOP_EVENTS  32
+
+struct wk_source;
+
+/* Called with the epoll events of the source, timers get EPOLLIN once
+ * per wakeup however many times they expired */
+typedef void (*wk_source_func)(struct wk_source *src, uint32_t events, void *data);
+
+/* A file descriptor watched by the loop */
+struct wk_source {
+    int fd;
+    uint32_t events;
+
+    /* Timers close their timerfd, other fds belong to the caller */
+    bool timer;
+    bool removed;
+
+    wk_source_func func;
+    void *data;
+
+    /* Next source in the list */
+    struct wk_source *next;
+};
+
+/* epoll set of the display's main loop */
+struct wk_loop {
+    int epfd;
+
+    /* Written by wk_loop_wakeup() from any thread */
+    int wakefd;
+    struct wk_source *wake;
+
+    /* Live sources, and removed ones freed after the dispatch */
+    struct wk_source *source_head;
+    struct wk_source *dead_head;
+};
+
+/* Functions */
+struct wk_loop *wk_loop_create();
+struct wk_source *wk_loop_add_fd(struct wk_loop *loop, int fd, uint32_t events,
+        wk_source_func func, void *data);
+void wk_loop_set_events(struct wk_loop *loop, struct wk_source *src, uint32_t events);
+struct wk_source *wk_loop_add_timer(struct wk_loop *loop, uint32_t delay_ms,
+        uint32_t interval_ms, wk_source_func func, void *data);
+void wk_loop_set_timer(struct wk_source *src, uint32_t delay_ms, uint32_t interval_ms);
+void wk_loop_set_timer_ns(struct wk_source *src, uint64_t delay_ns, uint64_t interval_ns);
+void wk_loop_remove(struct wk_loop *loop, struct wk_source *src);
+void wk_loop_wakeup(struct wk_loop *loop);
+int wk_loop_dispatch(struct wk_loop *loop, int timeout);
+void wk_loop_destroy(struct wk_loop *loop);
+
+#endif /* WK_LOOP_H */
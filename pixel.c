@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WK_PIXEL_X86
+#endif
+
+/*
+ * Over is dst = src + dst * (255 - src.a) / 255 per channel, with the
+ * division rounded as t = x + 128, (t + (t >> 8)) >> 8 and the sum
+ * saturated. The SIMD paths do exactly that in 16-bit lanes.
+ */
+
+static inline uint32_t _div255(uint32_t x)
+{
+    uint32_t t = x + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static void _fill_scalar(uint32_t *dst, uint32_t color, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+        dst[i] = color;
+}
+
+static void _copy_scalar(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    memmove(dst, src, count * 4);
+}
+
+static void _over_scalar(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        uint32_t s = src[i];
+        uint32_t d = dst[i];
+        uint32_t inv = 255 - (s >> 24);
+        uint32_t out = 0;
+
+        for(int shift = 0; shift < 32; shift += 8) {
+            uint32_t c = ((s >> shift) & 0xff) +
+                _div255(((d >> shift) & 0xff) * inv);
+            out |= min(c, 255u) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+static const struct wk_pixel_ops _ops_scalar = {
+    .name = "scalar",
+    .fill = _fill_scalar,
+    .copy = _copy_scalar,
+    .over = _over_scalar
+};
+
+#ifdef WK_PIXEL_X86
+
+/* SSE2, four pixels at a time */
+
+__attribute__((target("sse2")))
+static void _fill_sse2(uint32_t *dst, uint32_t color, size_t count)
+{
+    __m128i c = _mm_set1_epi32(color);
+    size_t i = 0;
+
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *) (dst + i), c);
+    _fill_scalar(dst + i, color, count - i);
+}
+
+__attribute__((target("sse2")))
+static void _copy_sse2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    /* Overlapping rows go through memmove */
+    if(dst < src + count && src < dst + count) {
+        _copy_scalar(dst, src, count);
+        return;
+    }
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *) (dst + i),
+                _mm_loadu_si128((const __m128i *) (src + i)));
+    _copy_scalar(dst + i, src + i, count - i);
+}
+
+/* dst * (255 - alpha) / 255 on one half of the pixels, in 16-bit lanes */
+__attribute__((target("sse2")))
+static inline __m128i _scale_sse2(__m128i d, __m128i s)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(d, inv), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void _over_sse2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+
+        __m128i lo = _scale_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+        __m128i hi = _scale_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+
+        _mm_storeu_si128((__m128i *) (dst + i),
+                _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+    _over_scalar(dst + i, src + i, count - i);
+}
+
+static const struct wk_pixel_ops _ops_sse2 = {
+    .name = "sse2",
+    .fill = _fill_sse2,
+    .copy = _copy_sse2,
+    .over = _over_sse2
+};
+
+/* AVX2, eight pixels at a time */
+
+__attribute__((target("avx2")))
+static void _fill_avx2(uint32_t *dst, uint32_t color, size_t count)
+{
+    __m256i c = _mm256_set1_epi32(color);
+    size_t i = 0;
+
+    for(; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i *) (dst + i), c);
+    _fill_sse2(dst + i, color, count - i);
+}
+
+__attribute__((target("avx2")))
+static void _copy_avx2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    if(dst < src + count && src < dst + count) {
+        _copy_scalar(dst, src, count);
+        return;
+    }
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                _mm256_loadu_si256((const __m256i *) (src + i)));
+    _copy_sse2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _scale_avx2(__m256i d, __m256i s)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(d, inv), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void _over_avx2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    /* Unpack and pack both work within 128-bit lanes, so they cancel */
+    for(; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+
+        __m256i lo = _scale_avx2(_mm256_unpacklo_epi8(d, zero),
+                _mm256_unpacklo_epi8(s, zero));
+        __m256i hi = _scale_avx2(_mm256_unpackhi_epi8(d, zero),
+                _mm256_unpackhi_epi8(s, zero));
+
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    _over_sse2(dst + i, src + i, count - i);
+}
+
+static const struct wk_pixel_ops _ops_avx2 = {
+    .name = "avx2",
+    .fill = _fill_avx2,
+    .copy = _copy_avx2,
+    .over = _over_avx2
+};
+
+/* AVX-512 (F and BW), sixteen pixels at a time */
+
+__attribute__((target("avx512f,avx512bw")))
+static void _fill_avx512(uint32_t *dst, uint32_t color, size_t count)
+{
+    __m512i c = _mm512_set1_epi32(color);
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16)
+        _mm512_storeu_si512(dst + i, c);
+    _fill_avx2(dst + i, color, count - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void _copy_avx512(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    if(dst < src + count && src < dst + count) {
+        _copy_scalar(dst, src, count);
+        return;
+    }
+
+    size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+        _mm512_storeu_si512(dst + i, _mm512_loadu_si512(src + i));
+    _copy_avx2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i _scale_avx512(__m512i d, __m512i s)
+{
+    __m512i alpha = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(s, 0xff), 0xff);
+    __m512i inv = _mm512_sub_epi16(_mm512_set1_epi16(255), alpha);
+    __m512i t = _mm512_add_epi16(_mm512_mullo_epi16(d, inv), _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void _over_avx512(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    __m512i zero = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16) {
+        __m512i s = _mm512_loadu_si512(src + i);
+        __m512i d = _mm512_loadu_si512(dst + i);
+
+        __m512i lo = _scale_avx512(_mm512_unpacklo_epi8(d, zero),
+                _mm512_unpacklo_epi8(s, zero));
+        __m512i hi = _scale_avx512(_mm512_unpackhi_epi8(d, zero),
+                _mm512_unpackhi_epi8(s, zero));
+
+        _mm512_storeu_si512(dst + i,
+                _mm512_adds_epu8(s, _mm512_packus_epi16(lo, hi)));
+    }
+    _over_avx2(dst + i, src + i, count - i);
+}
+
+static const struct wk_pixel_ops _ops_avx512 = {
+    .name = "avx512",
+    .fill = _fill_avx512,
+    .copy = _copy_avx512,
+    .over = _over_avx512
+};
+
+#endif /* WK_PIXEL_X86 */
+
+struct wk_pixel_ops wk_pixel = {
+    .name = "scalar",
+    .fill = _fill_scalar,
+    .copy = _copy_scalar,
+    .over = _over_scalar
+};
+
+/* Kernels of an instruction set, NULL if this CPU can't run them */
+const struct wk_pixel_ops *wk_pixel_ops_for(int isa)
+{
+#ifdef WK_PIXEL_X86
+    __builtin_cpu_init();
+
+    switch(isa) {
+        case WK_ISA_SSE2:
+            return __builtin_cpu_supports("sse2") ? &_ops_sse2 : NULL;
+        case WK_ISA_AVX2:
+            return __builtin_cpu_supports("avx2") ? &_ops_avx2 : NULL;
+        case WK_ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") &&
+                __builtin_cpu_supports("avx512bw") ? &_ops_avx512 : NULL;
+    }
+#endif
+    return isa == WK_ISA_SCALAR ? &_ops_scalar : NULL;
+}
+
+/* Pick the best kernels the CPU runs, WAYKIT_PIXEL=<name> caps the pick */
+void wk_pixel_init(void)
+{
+    const char *cap = getenv("WAYKIT_PIXEL");
+
+    for(int isa = 0; isa < WK_ISA_COUNT; isa++) {
+        const struct wk_pixel_ops *ops = wk_pixel_ops_for(isa);
+        if(ops)
+            wk_pixel = *ops;
+        if(ops && cap && strcmp(cap, ops->name) == 0)
+            break;
+    }
+
+    vlog("pixel kernels: %s", wk_pixel.name);
+}
+
+void wk_pixel_fill_rect(void *dst, uint32_t stride, const struct wk_rect *rect,
+        uint32_t color)
+{
+    unsigned char *row = (unsigned char *) dst + rect->y * stride + rect->x * 4;
+
+    for(int32_t y = 0; y < rect->height; y++, row += stride)
+        wk_pixel.fill((uint32_t *) row, color, rect->width);
+}
+
+void wk_pixel_clear_rect(void *dst, uint32_t stride, const struct wk_rect *rect)
+{
+    /* Whole rows are one memset away */
+    if(rect->x == 0 && rect->width * 4 == (int32_t) stride) {
+        memset((unsigned char *) dst + rect->y * stride, 0,
+                (size_t) stride * rect->height);
+        return;
+    }
+
+    wk_pixel_fill_rect(dst, stride, rect, 0);
+}
+
+void wk_pixel_copy_rect(void *dst, uint32_t dst_stride, const void *src,
+        uint32_t src_stride, const struct wk_rect *rect)
+{
+    unsigned char *d = (unsigned char *) dst + rect->y * dst_stride + rect->x * 4;
+    const unsigned char *s = (const unsigned char *) src +
+        rect->y * src_stride + rect->x * 4;
+
+    for(int32_t y = 0; y < rect->height; y++, d += dst_stride, s += src_stride)
+        wk_pixel.copy((uint32_t *) d, (const uint32_t *) s, rect->width);
+}
+
+void wk_pixel_over_rect(void *dst, uint32_t dst_stride, const void *src,
+        uint32_t src_stride, const struct wk_rect *rect)
+{
+    unsigned char *d = (unsigned char *) dst + rect->y * dst_stride + rect->x * 4;
+    const unsigned char *s = (const unsigned char *) src +
+        rect->y * src_stride + rect->x * 4;
+
+    for(int32_t y = 0; y < rect->height; y++, d += dst_stride, s += src_stride)
+        wk_pixel.over((uint32_t *) d, (const uint32_t *) s, rect->width);
+}
@@ -0,0 +1,39 @@
+#ifndef WK_PIXEL_H
+#define WK_PIXEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "region.h"
+
+/* Instruction sets pixel.c has kernels for, best last */
+#define WK_ISA_SCALAR   0
+#define WK_ISA_SSE2     1
+#define WK_ISA_AVX2     2
+#define WK_ISA_AVX512   3
+#define WK_ISA_COUNT    4
+
+/* Row kernels over premultiplied ARGB8888 pixels. Every path gives the
+ * same bytes as the scalar one */
+struct wk_pixel_ops {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t color, size_t count);
+    void (*copy)(uint32_t *dst, const uint32_t *src, size_t count);
+    void (*over)(uint32_t *dst, const uint32_t *src, size_t count);
+};
+
+/* Kernels picked by wk_pixel_init() */
+extern struct wk_pixel_ops wk_pixel;
+
+/* Functions */
+void wk_pixel_init(void);
+const struct wk_pixel_ops *wk_pixel_ops_for(int isa);
+
+void wk_pixel_fill_rect(void *dst, uint32_t stride, const struct wk_rect *rect,
+        uint32_t color);
+void wk_pixel_clear_rect(void *dst, uint32_t stride, const struct wk_rect *rect);
+void wk_pixel_copy_rect(void *dst, uint32_t dst_stride, const void *src,
+        uint32_t src_stride, const struct wk_rect *rect);
+void wk_pixel_over_rect(void *dst, uint32_t dst_stride, const void *src,
+        uint32_t src_stride, const struct wk_rect *rect);
+
+#endif /* WK_PIXEL_H */
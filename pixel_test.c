@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pixel.h"
+#include "util.h"
+
+/*
+ * Checks every kernel this CPU runs against the scalar ones, bit for bit,
+ * over all lengths up to TEST_LENGTH and every alignment in a cache line.
+ * Exits non-zero on the first mismatch. It is run by hand, nothing
+ * builds it for you:
+ *
+ *   cc -O2 -o pixel_test pixel_test.c pixel.c log.c -lpthread
+ */
+
+#define TEST_LENGTH     200
+#define TEST_OFFSETS    16
+#define TEST_SIZE       (TEST_LENGTH + TEST_OFFSETS + 16)
+#define TEST_ROUNDS     4
+
+static uint32_t _seed = 0x2545f491;
+
+static uint32_t _random(void)
+{
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    return _seed;
+}
+
+/* Premultiplied pixels, with the fully opaque and transparent alphas
+ * the kernels may special-case mixed in, and some that aren't valid
+ * premultiplied so the saturation gets exercised */
+static void _randomize(uint32_t *pixels, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        if(_random() % 8 == 0) {
+            pixels[i] = _random();
+            continue;
+        }
+
+        uint32_t alpha = _random() % 4 == 0 ? 0xff :
+            _random() % 4 == 0 ? 0 : _random() & 0xff;
+        uint32_t pixel = alpha << 24;
+
+        for(int shift = 0; shift < 24; shift += 8)
+            pixel |= (alpha ? _random() % (alpha + 1) : 0) << shift;
+        pixels[i] = pixel;
+    }
+}
+
+/* Compare the whole buffers, so writes past the span show up too */
+static int _compare(const char *isa, const char *op, const uint32_t *want,
+        const uint32_t *got, size_t offset, size_t length)
+{
+    for(size_t i = 0; i < TEST_SIZE; i++) {
+        if(want[i] == got[i])
+            continue;
+
+        fprintf(stderr, "%s %s: offset %zu length %zu, pixel %zu is %08x not %08x\n",
+                isa, op, offset, length, i, got[i], want[i]);
+        return 1;
+    }
+    return 0;
+}
+
+static int _check(const struct wk_pixel_ops *ref, const struct wk_pixel_ops *ops)
+{
+    static uint32_t src[TEST_SIZE], dst[TEST_SIZE], want[TEST_SIZE], got[TEST_SIZE];
+    int failed = 0;
+
+    for(int round = 0; round < TEST_ROUNDS; round++) {
+        for(size_t offset = 0; offset < TEST_OFFSETS; offset++) {
+            for(size_t length = 0; length <= TEST_LENGTH; length++) {
+                _randomize(src, TEST_SIZE);
+                _randomize(dst, TEST_SIZE);
+                uint32_t color = src[0];
+
+                memcpy(want, dst, sizeof(dst));
+                memcpy(got, dst, sizeof(dst));
+                ref->fill(want + offset, color, length);
+                ops->fill(got + offset, color, length);
+                failed |= _compare(ops->name, "fill", want, got, offset, length);
+
+                /* Source at its own alignment, one pixel further */
+                memcpy(want, dst, sizeof(dst));
+                memcpy(got, dst, sizeof(dst));
+                ref->copy(want + offset, src + offset / 2 + 1, length);
+                ops->copy(got + offset, src + offset / 2 + 1, length);
+                failed |= _compare(ops->name, "copy", want, got, offset, length);
+
+                memcpy(want, dst, sizeof(dst));
+                memcpy(got, dst, sizeof(dst));
+                ref->over(want + offset, src + offset / 2 + 1, length);
+                ops->over(got + offset, src + offset / 2 + 1, length);
+                failed |= _compare(ops->name, "over", want, got, offset, length);
+
+                if(failed)
+                    return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+    const struct wk_pixel_ops *ref = wk_pixel_ops_for(WK_ISA_SCALAR);
+    int failed = 0;
+
+    for(int isa = WK_ISA_SCALAR + 1; isa < WK_ISA_COUNT; isa++) {
+        const struct wk_pixel_ops *ops = wk_pixel_ops_for(isa);
+        if(!ops) {
+            printf("%-8s skipped, not supported here\n", names[isa]);
+            continue;
+        }
+
+        int result = _check(ref, ops);
+        printf("%-8s %s\n", names[isa], result ? "FAILED" : "ok");
+        failed |= result;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+
+#include "region.h"
+
+static inline int64_t _area(const struct wk_rect *r)
+{
+    return (int64_t) r->width * r->height;
+}
+
+static inline bool _overlaps(const struct wk_rect *a, const struct wk_rect *b)
+{
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+        a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/* Smallest rectangle holding both a and b */
+static struct wk_rect _bounds(const struct wk_rect *a, const struct wk_rect *b)
+{
+    struct wk_rect r;
+    r.x = min(a->x, b->x);
+    r.y = min(a->y, b->y);
+    r.width = max(a->x + a->width, b->x + b->width) - r.x;
+    r.height = max(a->y + a->height, b->y + b->height) - r.y;
+    return r;
+}
+
+static void _remove(struct wk_region *reg, int i)
+{
+    reg->rects[i] = reg->rects[--reg->count];
+}
+
+/* Intersection of a and b in out, false if they don't overlap */
+bool wk_rect_intersect(const struct wk_rect *a, const struct wk_rect *b,
+        struct wk_rect *out)
+{
+    if(!_overlaps(a, b))
+        return false;
+
+    out->x = max(a->x, b->x);
+    out->y = max(a->y, b->y);
+    out->width = min(a->x + a->width, b->x + b->width) - out->x;
+    out->height = min(a->y + a->height, b->y + b->height) - out->y;
+    return true;
+}
+
+void wk_region_clear(struct wk_region *reg)
+{
+    reg->count = 0;
+}
+
+/* Add a rectangle, keeping the region's rectangles disjoint */
+void wk_region_add(struct wk_region *reg, int32_t x, int32_t y,
+        int32_t width, int32_t height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    struct wk_rect new = { x, y, width, height };
+
+    /* Swallow every rectangle we touch, growing new as we go */
+    for(int i = 0; i < reg->count; ) {
+        if(_overlaps(&new, &reg->rects[i])) {
+            new = _bounds(&new, &reg->rects[i]);
+            _remove(reg, i);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if(reg->count < WK_REGION_RECTS) {
+        reg->rects[reg->count++] = new;
+        return;
+    }
+
+    /* Full, merge with whichever rectangle wastes the fewest pixels */
+    int best = 0;
+    int64_t best_cost = INT64_MAX;
+    for(int i = 0; i < reg->count; i++) {
+        struct wk_rect b = _bounds(&new, &reg->rects[i]);
+        int64_t cost = _area(&b) - _area(&new) - _area(&reg->rects[i]);
+        if(cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+
+    struct wk_rect merged = _bounds(&new, &reg->rects[best]);
+    _remove(reg, best);
+    wk_region_add(reg, merged.x, merged.y, merged.width, merged.height);
+}
+
+/* Restrict the region to a width x height buffer */
+void wk_region_clip(struct wk_region *reg, int32_t width, int32_t height)
+{
+    struct wk_rect bounds = { 0, 0, width, height };
+
+    for(int i = 0; i < reg->count; ) {
+        if(wk_rect_intersect(&reg->rects[i], &bounds, &reg->rects[i]))
+            i++;
+        else
+            _remove(reg, i);
+    }
+}
+
+bool wk_region_intersects(const struct wk_region *reg, const struct wk_rect *rect)
+{
+    for(int i = 0; i < reg->count; i++) {
+        if(_overlaps(&reg->rects[i], rect))
+            return true;
+    }
+    return false;
+}
+
+/* Number of pixels covered, exact since the rectangles are disjoint */
+int64_t wk_region_area(const struct wk_region *reg)
+{
+    int64_t area = 0;
+    for(int i = 0; i < reg->count; i++)
+        area += _area(&reg->rects[i]);
+    return area;
+}
@@ -0,0 +1,33 @@
+#ifndef WK_REGION_H
+#define WK_REGION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Past this many rectangles a region coalesces the closest ones */
+#define WK_REGION_RECTS 16
+
+/* A rectangle in surface or buffer coordinates */
+struct wk_rect {
+    int32_t x, y;
+    int32_t width, height;
+};
+
+/* A set of disjoint rectangles, overlapping ones are merged on add */
+struct wk_region {
+    int count;
+    struct wk_rect rects[WK_REGION_RECTS];
+};
+
+/* Functions */
+bool wk_rect_intersect(const struct wk_rect *a, const struct wk_rect *b,
+        struct wk_rect *out);
+
+void wk_region_clear(struct wk_region *reg);
+void wk_region_add(struct wk_region *reg, int32_t x, int32_t y,
+        int32_t width, int32_t height);
+void wk_region_clip(struct wk_region *reg, int32_t width, int32_t height);
+bool wk_region_intersects(const struct wk_region *reg, const struct wk_rect *rect);
+int64_t wk_region_area(const struct wk_region *reg);
+
+#endif /* WK_REGION_H */
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+#include "util.h"
+
+#include "shm.h"
+
+/* Sub-allocations are page aligned */
+#define PAGE_ALIGN(s)   (((s) + 4095) & ~((size_t) 4095))
+
+/* Return [offset, offset + size) to the free list, merging neighbours */
+static void _insert_free(struct wk_shm_pool *pool, size_t offset, size_t size)
+{
+    struct wk_shm_slot *prev = NULL;
+    struct wk_shm_slot *next = pool->free_head;
+    while(next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+
+    /* Grow the previous range if we follow it directly */
+    if(prev && prev->offset + prev->size == offset) {
+        prev->size += size;
+        if(next && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            prev->next = next->next;
+            free(next);
+        }
+        return;
+    }
+
+    /* Or the next one if we lead into it */
+    if(next && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return;
+    }
+
+    struct wk_shm_slot *slot = fzalloc(sizeof(struct wk_shm_slot));
+    slot->offset = offset;
+    slot->size = size;
+    slot->next = next;
+    if(prev)
+        prev->next = slot;
+    else
+        pool->free_head = slot;
+}
+
+/* Grow the memfd, the compositor's pool and our mapping to hold need more bytes */
+static bool _grow(struct wk_shm_pool *pool, size_t need)
+{
+    size_t size = pool->size * 2;
+    while(size < pool->size + need)
+        size *= 2;
+
+    /* wl_shm_pool sizes are int32_t */
+    if(size > INT32_MAX)
+        return false;
+
+    if(ftruncate(pool->fd, size) < 0)
+        return false;
+
+    void *data = mremap(pool->data, pool->size, size, MREMAP_MAYMOVE);
+    if(data == MAP_FAILED)
+        return false;
+
+    if(data != pool->data)
+        pool->generation++;
+
+    wl_shm_pool_resize(pool->wl_pool, size);
+    _insert_free(pool, pool->size, size - pool->size);
+
+    vlog("shm pool grown to %zu bytes", size);
+    pool->data = data;
+    pool->size = size;
+    return true;
+}
+
+struct wk_shm_pool *wk_shm_pool_create(struct wl_shm *shm, size_t size)
+{
+    struct wk_shm_pool *pool = fzalloc(sizeof(struct wk_shm_pool));
+    size = PAGE_ALIGN(size);
+
+    /* Sealed against shrinking so the compositor can't SIGBUS on us */
+    pool->fd = memfd_create("waykit-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(pool->fd < 0)
+        failsafe(0); /* No memfd */
+
+    if(ftruncate(pool->fd, size) < 0)
+        failsafe(0); /* Could not size the memfd */
+    fcntl(pool->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+
+    pool->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+    if(pool->data == MAP_FAILED)
+        failsafe(0); /* Could not map the pool */
+
+    pool->wl_pool = wl_shm_create_pool(shm, pool->fd, size);
+    pool->size = size;
+    _insert_free(pool, 0, size);
+    pthread_rwlock_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+/* First-fit allocation of size bytes, growing the pool when needed */
+bool wk_shm_alloc(struct wk_shm_pool *pool, size_t size, size_t *offset)
+{
+    size = PAGE_ALIGN(size);
+    pthread_rwlock_wrlock(&pool->lock);
+
+    while(1) {
+        struct wk_shm_slot *prev = NULL;
+        for(struct wk_shm_slot *slot = pool->free_head; slot; slot = slot->next) {
+            if(slot->size >= size) {
+                *offset = slot->offset;
+                slot->offset += size;
+                slot->size -= size;
+
+                if(slot->size == 0) {
+                    if(prev)
+                        prev->next = slot->next;
+                    else
+                        pool->free_head = slot->next;
+                    free(slot);
+                }
+
+                pool->used += size;
+                pthread_rwlock_unlock(&pool->lock);
+                return true;
+            }
+            prev = slot;
+        }
+
+        if(!_grow(pool, size)) {
+            pthread_rwlock_unlock(&pool->lock);
+            return false;
+        }
+    }
+}
+
+void wk_shm_free(struct wk_shm_pool *pool, size_t offset, size_t size)
+{
+    size = PAGE_ALIGN(size);
+    pthread_rwlock_wrlock(&pool->lock);
+    pool->used -= size;
+    _insert_free(pool, offset, size);
+    pthread_rwlock_unlock(&pool->lock);
+}
+
+/* Keep data where it is while drawing into it, see wk_window_render() */
+void wk_shm_pool_lock(struct wk_shm_pool *pool)
+{
+    pthread_rwlock_rdlock(&pool->lock);
+}
+
+void wk_shm_pool_unlock(struct wk_shm_pool *pool)
+{
+    pthread_rwlock_unlock(&pool->lock);
+}
+
+void wk_shm_pool_destroy(struct wk_shm_pool *pool)
+{
+    struct wk_shm_slot *slot = pool->free_head;
+    while(slot != NULL) {
+        struct wk_shm_slot *to_del = slot;
+        slot = slot->next;
+        free(to_del);
+    }
+
+    pthread_rwlock_destroy(&pool->lock);
+    wl_shm_pool_destroy(pool->wl_pool);
+    munmap(pool->data, pool->size);
+    close(pool->fd);
+    free(pool);
+}
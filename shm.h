@@ -0,0 +1,50 @@
+#ifndef WK_SHM_H
+#define WK_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <wayland-client.h>
+
+/* Initial size of a display's pool, memfd pages cost nothing until used */
+#define WK_SHM_POOL_SIZE    (16 * 1024 * 1024)
+
+/* A free range of the pool, kept sorted by offset */
+struct wk_shm_slot {
+    size_t offset;
+    size_t size;
+
+    /* Next free range in the list */
+    struct wk_shm_slot *next;
+};
+
+/* One memfd mapped once and shared by every buffer of a display */
+struct wk_shm_pool {
+    int fd;
+    struct wl_shm_pool *wl_pool;
+
+    void *data;
+    size_t size;
+    size_t used;
+
+    /* Bumped when growing moved data, pointers into it are stale */
+    uint32_t generation;
+
+    /* Held for writing to change the pool, for reading while drawing
+     * into it so no other thread moves data underneath */
+    pthread_rwlock_t lock;
+
+    /* List of free ranges */
+    struct wk_shm_slot *free_head;
+};
+
+/* Functions */
+struct wk_shm_pool *wk_shm_pool_create(struct wl_shm *shm, size_t size);
+bool wk_shm_alloc(struct wk_shm_pool *pool, size_t size, size_t *offset);
+void wk_shm_free(struct wk_shm_pool *pool, size_t offset, size_t size);
+void wk_shm_pool_lock(struct wk_shm_pool *pool);
+void wk_shm_pool_unlock(struct wk_shm_pool *pool);
+void wk_shm_pool_destroy(struct wk_shm_pool *pool);
+
+#endif /* WK_SHM_H */
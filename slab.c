@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <string.h>
+#include "util.h"
+
+#include "slab.h"
+
+/* Pages start with their header, objects follow at WK_SLAB_ALIGN */
+#define _HEADER \
+    ((sizeof(struct wk_slab_page) + WK_SLAB_ALIGN - 1) & ~(size_t) (WK_SLAB_ALIGN - 1))
+
+static size_t _object_size(struct wk_slab *slab)
+{
+    return (slab->size + WK_SLAB_ALIGN - 1) & ~(size_t) (WK_SLAB_ALIGN - 1);
+}
+
+static size_t _page_size(struct wk_slab *slab)
+{
+    return max(WK_SLAB_PAGE, _HEADER + _object_size(slab) * WK_SLAB_OBJECTS);
+}
+
+/* Add a page and put all of its objects on the free list */
+static bool _grow(struct wk_slab *slab)
+{
+    size_t size = _page_size(slab);
+    size_t object = _object_size(slab);
+
+    struct wk_slab_page *page = malloc(size);
+    if(!page)
+        return false;
+    page->next = slab->page_head;
+    slab->page_head = page;
+    slab->pages++;
+
+    /* Linked back to front so the list hands them out in address order */
+    char *first = (char *) page + _HEADER;
+    size_t count = (size - _HEADER) / object;
+    for(size_t i = count; i-- > 0;) {
+        void **obj = (void **) (first + i * object);
+        *obj = slab->free_head;
+        slab->free_head = obj;
+    }
+    return true;
+}
+
+/* A zeroed object, NULL when out of memory like calloc() */
+void *wk_slab_alloc(struct wk_slab *slab)
+{
+    pthread_mutex_lock(&slab->lock);
+    if(!slab->free_head && !_grow(slab)) {
+        pthread_mutex_unlock(&slab->lock);
+        return NULL;
+    }
+
+    void **obj = slab->free_head;
+    slab->free_head = *obj;
+    slab->objects++;
+    pthread_mutex_unlock(&slab->lock);
+
+    memset(obj, 0, slab->size);
+    return obj;
+}
+
+void wk_slab_free(struct wk_slab *slab, void *ptr)
+{
+    if(!ptr)
+        return;
+
+    void **obj = ptr;
+    pthread_mutex_lock(&slab->lock);
+    *obj = slab->free_head;
+    slab->free_head = obj;
+    slab->objects--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/* Give the pages back once no object is in use */
+void wk_slab_trim(struct wk_slab *slab)
+{
+    pthread_mutex_lock(&slab->lock);
+    if(slab->objects == 0) {
+        while(slab->page_head) {
+            struct wk_slab_page *page = slab->page_head;
+            slab->page_head = page->next;
+            free(page);
+        }
+        slab->free_head = NULL;
+        slab->pages = 0;
+    }
+    pthread_mutex_unlock(&slab->lock);
+}
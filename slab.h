@@ -0,0 +1,43 @@
+#ifndef WK_SLAB_H
+#define WK_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Pages are at least this big, and hold WK_SLAB_OBJECTS objects at least */
+#define WK_SLAB_PAGE        16384
+#define WK_SLAB_OBJECTS     8
+
+/* Object alignment, enough for anything malloc would hand out */
+#define WK_SLAB_ALIGN       16
+
+/* A static pool of objects of one size, safe to use from any thread */
+#define WK_SLAB_SIZED(s)    { .size = (s), .lock = PTHREAD_MUTEX_INITIALIZER }
+#define WK_SLAB_INIT(type)  WK_SLAB_SIZED(sizeof(type))
+
+/* Fixed-size objects carved out of pages, freed ones are reused first
+ * and pages stay around until wk_slab_trim() finds them all free */
+struct wk_slab {
+    size_t size;
+    pthread_mutex_t lock;
+
+    /* Free objects, linked through their first word */
+    void *free_head;
+    struct wk_slab_page *page_head;
+
+    /* Counters */
+    uint64_t objects;   /* Handed out and not freed */
+    uint64_t pages;
+};
+
+struct wk_slab_page {
+    struct wk_slab_page *next;
+};
+
+/* Functions */
+void *wk_slab_alloc(struct wk_slab *slab);
+void wk_slab_free(struct wk_slab *slab, void *ptr);
+void wk_slab_trim(struct wk_slab *slab);
+
+#endif /* WK_SLAB_H */
@@ -4,14 +4,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include "log.h"
 
 #define STRINGIFY(x) #x
 
 #define red(x)  "\033[1m\033[31m"x"\033[39;49m"
 
-// TODO: Create log.c and get better logging
-#define nlog(x) fprintf(stderr, x"\n");
-#define vlog(x, ...) fprintf(stderr, x"\n", __VA_ARGS__)
+/* Formatted later by log.c, vlog is for chatter from hot paths */
+#define nlog(x) wk_log(WK_LOG_INFO, x)
+#define vlog(x, ...) wk_log(WK_LOG_DEBUG, x, __VA_ARGS__)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
@@ -21,6 +22,7 @@ static inline void* _failsafe(void* data, const char* file, const int line,
         const char* inst)
 {
     if(!data) {
+        wk_log_flush();
         fprintf(stderr, red("failsafe: %s at %s:%d \n"), inst, file, line);
         if(errno != 0)
             perror("failsafe: system");
@@ -1,24 +1,38 @@
 #include <stdbool.h>
-#include <unistd.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <errno.h>
 #include <wayland-client.h>
 #include <cairo/cairo.h>
 #include "xdg-shell-unstable-v6.h"
+#include "presentation-time.h"
+#include "viewporter.h"
 #include "util.h"
 #include "event.h"
+#include "shm.h"
+#include "worker.h"
+#include "pixel.h"
+#include "hist.h"
+#include "slab.h"
 
 #include "window.h"
 
-/* Declared before the shell_surface listener */
-static struct wk_window_buffer *_create_buffer(struct wk_window *win, uint32_t width,
-        uint32_t height);
+/* Contexts and presentation feedback come and go often */
+static struct wk_slab _context_slab = WK_SLAB_INIT(struct wk_context);
+static struct wk_slab _feedback_slab = WK_SLAB_INIT(struct wk_feedback);
+
+static void _delete_buffer(struct wk_window_buffer *buffer);
+static void _damage_context(struct wk_context *ctx, int32_t x, int32_t y,
+        int32_t width, int32_t height);
 
 /* wl_buffer listener */
 static void _handle_release(void *data, struct wl_buffer *wl_buffer)
 {
     struct wk_window_buffer *buf = data;
     buf->busy = false;
+
+    /* The swapchain let go of it while the compositor was reading it */
+    if(buf->orphan)
+        _delete_buffer(buf);
 }
 
 struct wl_buffer_listener buffer_listener = {
@@ -26,21 +40,105 @@ struct wl_buffer_listener buffer_listener = {
 };
 /* end wl_buffer listener */
 
-/* wl_shm listener */
-static void _handle_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+/* wl_callback listener for wl_surface.frame */
+static void _handle_frame_done(void *data, struct wl_callback *wl_callback,
+        uint32_t time)
 {
     struct wk_window *win = data;
-    struct wk_window_format *fmt = fzalloc(sizeof(struct wk_window_format));
 
-    fmt->value = format;
-    fmt->next = win->format_head;
-    win->format_head = fmt;
+    /* The compositor wants a new frame, dirty windows render next loop */
+    wl_callback_destroy(wl_callback);
+    win->frame_cb = NULL;
+    win->frame_time = time;
+
+    /* Without presentation feedback this is our best guess of a vblank */
+    if((win->flags & WKW_PACED) && !win->disp->presentation)
+        win->pacing.vblank = wk_clock_ns(win->disp->clock);
+}
+
+struct wl_callback_listener frame_listener = {
+    .done = _handle_frame_done
+};
+/* end wl_callback listener */
+
+/* Take a buffer out of the swapchain, busy ones are freed on release */
+static void _drop_buffer(struct wk_window *win, int index)
+{
+    struct wk_window_buffer *buf = win->buffers[index];
+
+    win->buffers[index] = win->buffers[--win->buffer_count];
+    win->buffers[win->buffer_count] = NULL;
+    if(win->buffer == buf)
+        win->buffer = NULL;
+
+    if(buf->busy)
+        buf->orphan = true;
+    else
+        _delete_buffer(buf);
+}
+
+/* wp_presentation_feedback listener */
+static void _drop_feedback(struct wk_feedback *fb)
+{
+    struct wk_feedback **link = &fb->win->feedback_head;
+    while(*link != fb)
+        link = &(*link)->next;
+    *link = fb->next;
+
+    wp_presentation_feedback_destroy(fb->wp_feedback);
+    wk_slab_free(&_feedback_slab, fb);
+}
+
+static void _handle_sync_output(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback,
+        struct wl_output *output)
+{
+}
+
+static void _handle_presented(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+        uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    struct wk_feedback *fb = data;
+    struct wk_window *win = fb->win;
+    uint64_t sec = ((uint64_t) tv_sec_hi << 32) | tv_sec_lo;
+    uint64_t shown = sec * 1000000000 + tv_nsec;
+
+    if(win->timing && shown >= fb->commit)
+        wk_hist_record(&win->timing->present, shown - fb->commit);
+
+    /* Pacing lines up with the vblanks the compositor reports */
+    win->pacing.vblank = shown;
+    if(refresh)
+        win->pacing.refresh = refresh;
+    if(fb->target && refresh && shown > fb->target + refresh / 2)
+        win->stats.late++;
+    _drop_feedback(fb);
+}
+
+static void _handle_discarded(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback)
+{
+    struct wk_feedback *fb = data;
+    if(fb->win->timing)
+        fb->win->timing->discarded++;
+    _drop_feedback(fb);
 }
 
-struct wl_shm_listener shm_listener = {
-    .format = _handle_format
+struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = _handle_sync_output,
+    .presented = _handle_presented,
+    .discarded = _handle_discarded
 };
-/* end wl_shm listener */
+/* end wp_presentation_feedback listener */
+
+/* Drop every buffer of the swapchain */
+static void _reset_swapchain(struct wk_window *win)
+{
+    while(win->buffer_count > 0)
+        _drop_buffer(win, win->buffer_count - 1);
+}
 
 /* zxdg_surface listener */
 static void _handle_surf_configure(void *data, struct zxdg_surface_v6 *zxdg_surface,
@@ -48,11 +146,13 @@ static void _handle_surf_configure(void *data, struct zxdg_surface_v6 *zxdg_surf
 {
     struct wk_window *win = data;
 
-    if((win->width != win->buffer->width) || (win->height != win->buffer->height))
-        win->buffer = _create_buffer(win, win->width, win->height);
+    /* Only the latest configure matters, it is applied and acked by the
+     * next render so a resize storm costs one resize per frame */
+    win->configure_serial = serial;
+    win->configure_pending = true;
+    win->dirty = true;
 
-    vlog("surf configure: %d %d %d", serial, win->width, win->height);
-    zxdg_surface_v6_ack_configure(zxdg_surface, serial);
+    vlog("surf configure: %d %d %d", serial, win->pending_width, win->pending_height);
 }
 
 struct zxdg_surface_v6_listener zxdg_surface_listener = {
@@ -69,8 +169,8 @@ void _handle_configure(void *data, struct zxdg_toplevel_v6 *zxdg_toplevel_v6,
         return;
 
     struct wk_window *win = data;
-    win->width = width;
-    win->height = height;
+    win->pending_width = width;
+    win->pending_height = height;
 }
 
 void _handle_close(void *data, struct zxdg_toplevel_v6 *zxdg_toplevel_v6)
@@ -84,205 +184,1897 @@ struct zxdg_toplevel_v6_listener zxdg_toplevel_listener = {
 };
 /* zxdg_toplevel listener */
 
-/* Create pool file for our buffer */
-static int _create_pool_file(size_t size, char **name)
+static void _delete_buffer(struct wk_window_buffer *buffer)
 {
-    static const char template[] = "waykit-XXXXXX";
-
-    const char *path = getenv("XDG_RUNTIME_DIR");
-    if (!path)
-        return -1;
+    cairo_destroy(buffer->cairo);
+    cairo_surface_destroy(buffer->cairo_surface);
+    wl_buffer_destroy(buffer->wl_buffer);
+    wk_shm_free(buffer->pool, buffer->offset, buffer->size);
+    free(buffer);
+}
 
-    int ts = (path[strlen(path) - 1] == '/');
+/* (Re)create the cairo objects over the buffer's pixels */
+static void _map_buffer(struct wk_window *win, struct wk_window_buffer *buf)
+{
+    if(buf->cairo) {
+        cairo_destroy(buf->cairo);
+        cairo_surface_destroy(buf->cairo_surface);
+    }
 
-    *name = malloc(
-            strlen(template) +
-            strlen(path) +
-            (ts ? 0 : 1) + 1);
-    sprintf(*name, "%s%s%s", path, ts ? "" : "/", template);
+    buf->pixels = (unsigned char *) buf->pool->data + buf->offset;
+    buf->generation = buf->pool->generation;
+    buf->cairo_surface = cairo_image_surface_create_for_data(buf->pixels,
+                    buf->format == WL_SHM_FORMAT_XRGB8888 ? CAIRO_FORMAT_RGB24 :
+                    CAIRO_FORMAT_ARGB32, buf->width, buf->height, buf->stride);
+    buf->cairo = cairo_create(buf->cairo_surface);
 
-    int fd = mkstemp(*name);
-    if (fd < 0)
-        return -1;
+    /* A new id makes contexts rebind to the new pointer */
+    buf->id = ++win->buffer_serial;
+}
 
-    if (ftruncate(fd, size) < 0) {
-        close(fd);
-        return -1;
+/* Round a dimension up to the next of 256, 384, 512, 768, 1024, ... so
+ * buffers of an elastic window survive most of a drag */
+static uint32_t _spare(uint32_t n)
+{
+    uint32_t step = 256;
+    while(step < n) {
+        if(step + step / 2 >= n)
+            return step + step / 2;
+        step *= 2;
     }
+    return step;
+}
 
-    return fd;
+/* Opaque windows skip the alpha channel when the compositor takes it.
+ * Contexts still draw ARGB32, the X byte is ignored */
+static uint32_t _buffer_format(struct wk_window *win)
+{
+    if((win->flags & WKW_OPAQUE) &&
+            wk_display_has_format(win->disp, WL_SHM_FORMAT_XRGB8888))
+        return WL_SHM_FORMAT_XRGB8888;
+    return WL_SHM_FORMAT_ARGB8888;
 }
 
-static void _delete_buffer(struct wk_window_buffer *buffer)
+/* Pixels of a window length in the window's buffers */
+static int32_t _scaled(struct wk_window *win, int32_t length)
 {
-    cairo_surface_destroy(buffer->cairo_surface);
-    cairo_destroy(buffer->cairo);
-    wl_buffer_destroy(buffer->wl_buffer);
-    free(buffer);
+    return (length * win->scaling.scale + WK_SCALE_ONE - 1) / WK_SCALE_ONE;
 }
 
-static struct wk_window_buffer *_create_buffer(struct wk_window *win, uint32_t width,
-        uint32_t height)
+/* Window region in buffer pixels, covering every pixel it touches */
+static void _scale_region(struct wk_window *win, const struct wk_region *in,
+        struct wk_region *out)
 {
-    char *name;
-    uint32_t stride = width * 4;
-    uint32_t size = stride * height;
+    int scale = win->scaling.scale;
 
-    if(win->buffer)
-       _delete_buffer(win->buffer);
+    if(scale == WK_SCALE_ONE) {
+        *out = *in;
+        return;
+    }
 
-    struct wk_window_buffer* buf = fzalloc(sizeof(struct wk_window_buffer));
-    int fd = _create_pool_file(size, &name);
-
-    // TODO: Check that we have the WL_SHM_FORMAT_ARGB8888 available
-    buf->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    struct wl_shm_pool *pool = wl_shm_create_pool(win->disp->shm, fd, size);
-    buf->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
-                    width, height, stride, WL_SHM_FORMAT_ARGB8888);
-    wl_shm_pool_destroy(pool);
-    close(fd);
-    unlink(name);
-    free(name);
+    wk_region_clear(out);
+    for(int i = 0; i < in->count; i++) {
+        const struct wk_rect *r = &in->rects[i];
+        int32_t x0 = r->x * scale / WK_SCALE_ONE;
+        int32_t y0 = r->y * scale / WK_SCALE_ONE;
+        wk_region_add(out, x0, y0, _scaled(win, r->x + r->width) - x0,
+                _scaled(win, r->y + r->height) - y0);
+    }
+}
+
+/* Grow a region to whole blocks of WK_SCALE_ONE window pixels, which
+ * land on whole buffer pixels at any scale. Contexts are clipped to it,
+ * so pixels cleared for them are also fully repainted */
+static void _align_region(struct wk_window *win, struct wk_region *reg)
+{
+    if(win->scaling.scale == WK_SCALE_ONE)
+        return;
+
+    struct wk_region aligned;
+    wk_region_clear(&aligned);
+    for(int i = 0; i < reg->count; i++) {
+        struct wk_rect *r = &reg->rects[i];
+        int32_t x0 = r->x & ~(WK_SCALE_ONE - 1);
+        int32_t y0 = r->y & ~(WK_SCALE_ONE - 1);
+        int32_t x1 = (r->x + r->width + WK_SCALE_ONE - 1) & ~(WK_SCALE_ONE - 1);
+        int32_t y1 = (r->y + r->height + WK_SCALE_ONE - 1) & ~(WK_SCALE_ONE - 1);
+        wk_region_add(&aligned, x0, y0, x1 - x0, y1 - y0);
+    }
+
+    wk_region_clip(&aligned, win->width, win->height);
+    *reg = aligned;
+}
+
+/* (Re)create the wl_buffer over the buffer's memory at width x height */
+static void _attach_buffer(struct wk_window *win, struct wk_window_buffer *buf,
+        uint32_t width, uint32_t height, uint32_t format)
+{
+    if(buf->wl_buffer)
+        wl_buffer_destroy(buf->wl_buffer);
+
+    buf->format = format;
+    buf->wl_buffer = wl_shm_pool_create_buffer(buf->pool->wl_pool, buf->offset,
+                    width, height, buf->stride, buf->format);
+    wl_proxy_set_queue((struct wl_proxy *) buf->wl_buffer, win->queue);
+    wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
 
-    buf->busy = false;
     buf->width = width;
     buf->height = height;
-    //buf->cairo_surface = cairo_image_surface_create_for_data(buf->pixels,
-    //                CAIRO_FORMAT_ARGB32, width, height, stride);
-    //buf->cairo = cairo_create(buf->cairo_surface);
+    buf->frame = 0;
+    _map_buffer(win, buf);
+}
 
-    wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
+static struct wk_window_buffer *_create_buffer(struct wk_window *win, uint32_t width,
+        uint32_t height, uint32_t format)
+{
+    /* Elastic windows keep room to grow, the stride never changes */
+    uint32_t room_width = width, room_height = height;
+    if(win->flags & WKW_ELASTIC) {
+        room_width = _spare(width);
+        room_height = _spare(height);
+    }
 
-    win->buffer = buf;
+    struct wk_window_buffer* buf = fzalloc(sizeof(struct wk_window_buffer));
+    buf->pool = win->disp->pool;
+    buf->stride = room_width * 4;
+    buf->size = (size_t) buf->stride * room_height;
+    if(!wk_shm_alloc(buf->pool, buf->size, &buf->offset))
+        failsafe(0); /* Out of shm */
+
+    buf->busy = false;
+    _attach_buffer(win, buf, width, height, format);
+    win->stats.allocs++;
 
-    nlog("created buffer");
+    vlog("created buffer %d (%dx%d)", buf->id, width, height);
     return buf;
 }
 
-struct wk_window *wk_window_create(struct wk_display *disp, int width, int height)
+/* Bring a released buffer to the window's buffer size and format, in place when
+ * it has the room. False when it had to be dropped */
+static bool _fit_buffer(struct wk_window *win, int index)
 {
-    failsafe(disp);
+    struct wk_window_buffer *buf = win->buffers[index];
+    int32_t width = _scaled(win, win->width);
+    int32_t height = _scaled(win, win->height);
+    bool resize = buf->width != (uint32_t) width || buf->height != (uint32_t) height;
+    if(!resize && buf->format == _buffer_format(win))
+        return true;
 
-    struct wk_window *win = fzalloc(sizeof(struct wk_window));
-    win->disp = disp;
-    win->surface = wl_compositor_create_surface(disp->compositor);
-    win->zxdg_surface = zxdg_shell_v6_get_xdg_surface(disp->shell, win->surface);
-    win->zxdg_toplevel = zxdg_surface_v6_get_toplevel(win->zxdg_surface);
-    win->buffer = _create_buffer(win, width, height);
+    bool room = width * 4 <= buf->stride &&
+        (size_t) buf->stride * height <= buf->size;
+    if(resize && (!(win->flags & WKW_ELASTIC) || !room)) {
+        _drop_buffer(win, index);
+        return false;
+    }
 
-    wl_shm_add_listener(disp->shm, &shm_listener, win);
+    /* Same memory and stride, only the wl_buffer is new */
+    _attach_buffer(win, buf, width, height, _buffer_format(win));
+    if(resize)
+        win->stats.resizes++;
+    return true;
+}
 
-    zxdg_surface_v6_add_listener(win->zxdg_surface, &zxdg_surface_listener, win);
-    zxdg_toplevel_v6_add_listener(win->zxdg_toplevel, &zxdg_toplevel_listener, win);
-    disp->window = win;
+/* Pick the first released buffer, or grow the swapchain up to its limit */
+static struct wk_window_buffer *_next_buffer(struct wk_window *win)
+{
+    struct wk_window_buffer *buf = NULL;
 
-    win->width = width;
-    win->height = height;
+    for(int i = 0; i < win->buffer_count; i++) {
+        if(win->buffers[i]->busy)
+            continue;
+        if(!_fit_buffer(win, i)) {
+            i--;
+            continue;
+        }
+        buf = win->buffers[i];
+        break;
+    }
 
-    wl_surface_commit(win->surface);
+    if(!buf && win->buffer_count < win->buffer_limit) {
+        buf = _create_buffer(win, _scaled(win, win->width), _scaled(win, win->height),
+                _buffer_format(win));
+        win->buffers[win->buffer_count++] = buf;
+    }
 
-    nlog("window created");
-    return win;
+    if(buf)
+        return buf;
+
+    /* Everything is held by the compositor, wait for a release */
+    win->stats.waits++;
+    return NULL;
 }
 
-void wk_window_register_draw(struct wk_window *win, void (*fun)(uint32_t width,
-            uint32_t height, void *pixels, cairo_t *cairo))
+static void _unbind_context(struct wk_context *ctx)
 {
-    struct wk_draw_node *new = fzalloc(sizeof(struct wk_draw_node));
-    new->function = fun;
+    if(ctx->cairo)
+        cairo_destroy(ctx->cairo);
+    if(ctx->surface)
+        cairo_surface_destroy(ctx->surface);
 
-    new->next = win->draw_cb_head;
-    win->draw_cb_head = new;
+    ctx->cairo = NULL;
+    ctx->surface = NULL;
+    ctx->buffer_id = 0;
 }
 
-void wk_window_render(struct wk_window *win)
+/* Point the context's cairo surface at its rectangle in a target (a
+ * buffer, a layer cache or a plane) identified by id, that covers
+ * target_width x target_height of the window from target_x, target_y.
+ * A target at a scale other than WK_SCALE_ONE is target_width x
+ * target_height pixels */
+static void _bind_context(struct wk_context *ctx, uint32_t id, unsigned char *pixels,
+        uint32_t stride, int32_t target_x, int32_t target_y,
+        int32_t target_width, int32_t target_height, int scale)
 {
-    for(struct wk_draw_node* node = win->draw_cb_head; node != NULL; node = node->next) {
-        (*node->function)(win->buffer->width, win->buffer->height,
-                win->buffer->pixels, win->buffer->cairo);
+    if(ctx->buffer_id == id)
+        return;
+
+    /* Clamp to the target so cairo never writes outside of it */
+    int x = max(ctx->x, target_x);
+    int y = max(ctx->y, target_y);
+    int width = min(ctx->x + ctx->width, target_x + target_width) - x;
+    int height = min(ctx->y + ctx->height, target_y + target_height) - y;
+    unsigned char *data = pixels + ((y - target_y) * stride) + ((x - target_x) * 4);
+
+    /* Scaled, the context rarely starts on a whole pixel. It gets all of
+     * the target and its clip keeps it in, see _draw_context() */
+    double factor = (double) scale / WK_SCALE_ONE;
+    if(scale != WK_SCALE_ONE) {
+        x = target_x;
+        y = target_y;
+        width = target_width;
+        height = target_height;
+        data = pixels;
+    }
+
+    /* A buffer resized in place keeps its memory and stride, so the
+     * surface we have may still be the right one */
+    if(ctx->surface &&
+            cairo_image_surface_get_data(ctx->surface) == data &&
+            cairo_image_surface_get_stride(ctx->surface) == (int) stride &&
+            cairo_image_surface_get_width(ctx->surface) == width &&
+            cairo_image_surface_get_height(ctx->surface) == height &&
+            ctx->scale == factor) {
+        ctx->buffer_id = id;
+        return;
     }
 
-    wl_surface_attach(win->surface, win->buffer->wl_buffer, 0, 0);
+    _unbind_context(ctx);
+    ctx->buffer_id = id;
+    if(width <= 0 || height <= 0)
+        return;
 
-    // TODO: I am redrawing the whole screen :/ We need those frames bad.
-    wl_surface_damage(win->surface, 0, 0, win->buffer->width, win->buffer->height);
-    wl_surface_commit(win->surface);
+    ctx->surface = cairo_image_surface_create_for_data(data,
+            CAIRO_FORMAT_ARGB32,
+            width,
+            height,
+            stride);
+    cairo_surface_set_device_scale(ctx->surface, factor, factor);
+    ctx->cairo = cairo_create(ctx->surface);
+    ctx->scale = factor;
+
+    /* Keep the context's own coordinates when it is clipped */
+    cairo_translate(ctx->cairo, ctx->x - x, ctx->y - y);
 }
 
-void wk_window_destroy(struct wk_window *win)
+/* Hand one event to the context's callback */
+static void _deliver_event(struct wk_context *ctx, struct wk_event *ev,
+        cairo_t *cairo)
 {
-    _delete_buffer(win->buffer);
+    if(ctx->batch) {
+        ctx->batch(ctx, ev, 1, cairo);
+        return;
+    }
 
-    zxdg_surface_v6_destroy(win->zxdg_surface);
-    zxdg_toplevel_v6_destroy(win->zxdg_toplevel);
-    wl_surface_destroy(win->surface);
+    do {
+        ctx->retcode = ctx->callback(ctx, ev, cairo);
+    } while(ctx->retcode == WKR_RECALL);
+}
 
-    struct wk_window_format *fmt_head = win->format_head;
-    while(fmt_head != NULL) {
-        struct wk_window_format* to_del = fmt_head;
-        fmt_head = fmt_head->next;
-        free(to_del);
+/* Hand a run of events of one type to the context, and return how many
+ * it took. Per event callbacks take them all, one call each, and so do
+ * batch functions for WKE_BEGIN, WKE_END and WKE_DRAW */
+static int _deliver_batch(struct wk_context *ctx, struct wk_event *evs, int count)
+{
+    /* min() and max() are macros, call it once */
+    if(ctx->batch && evs->type > WKE_DRAW) {
+        int taken = ctx->batch(ctx, evs, count, NULL);
+        return min(max(taken, 0), count);
     }
 
-    struct wk_context *ctx_head = win->context_head;
-    while(ctx_head != NULL) {
-        struct wk_context *to_del = ctx_head;
+    for(int i = 0; i < count; i++)
+        _deliver_event(ctx, &evs[i], NULL);
+    return count;
+}
+
+/* Pull the context's pending events into the window's batch buffer,
+ * after those it left last time */
+static int _gather_events(struct wk_context *ctx)
+{
+    struct wk_window *win = ctx->win;
+    int count = 0;
+
+    while(1) {
+        if(count == win->batch_cap || ctx->held_count > win->batch_cap) {
+            win->batch_cap = max(max(64, win->batch_cap * 2), ctx->held_count);
+            win->batch = failsafe(realloc(win->batch,
+                        win->batch_cap * sizeof(struct wk_event)));
+        }
+
+        if(ctx->held_count) {
+            memcpy(win->batch, ctx->held, ctx->held_count * sizeof(struct wk_event));
+            count = ctx->held_count;
+            free(ctx->held);
+            ctx->held = NULL;
+            ctx->held_count = 0;
+            continue;
+        }
+
+        if(!wk_event_dequeue(ctx, &win->batch[count]))
+            return count;
+        count++;
+    }
+}
+
+/* Run the context's callback over its pending events, one call per run
+ * of consecutive events of the same type with a batch function */
+static void _dispatch_context(struct wk_context *ctx)
+{
+    struct wk_window *win = ctx->win;
+    if(!ctx->callback && !ctx->batch)
+        return;
+
+    int held = ctx->held_count;
+    int count = _gather_events(ctx);
+    int done = 0;
+    while(done < count) {
+        int run = 1;
+        while(done + run < count && win->batch[done + run].type == win->batch[done].type)
+            run++;
+
+        int taken = _deliver_batch(ctx, &win->batch[done], run);
+        done += taken;
+        if(taken < run)
+            break;
+    }
+
+    /* Left for later. Another render only helps if this one took some
+     * or brought new ones, else they wait for whatever renders next */
+    if(done < count) {
+        ctx->held_count = count - done;
+        ctx->held = failsafe(malloc(ctx->held_count * sizeof(struct wk_event)));
+        memcpy(ctx->held, &win->batch[done], ctx->held_count * sizeof(struct wk_event));
+        if(done > 0 || count > held)
+            wk_window_invalidate(win);
+    }
+}
+
+/* Paint a retained context from its display list, recording the list
+ * first if the context invalidated itself since */
+static void _replay_context(struct wk_context *ctx)
+{
+    if(!atomic_exchange(&ctx->recorded, true)) {
+        if(ctx->list)
+            cairo_surface_destroy(ctx->list);
+
+        cairo_rectangle_t extents = { 0, 0, ctx->width, ctx->height };
+        ctx->list = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+
+        cairo_t *cairo = cairo_create(ctx->list);
+        struct wk_event draw = { .type = WKE_DRAW };
+        _deliver_event(ctx, &draw, cairo);
+        cairo_destroy(cairo);
+    }
+
+    cairo_set_source_surface(ctx->cairo, ctx->list, 0, 0);
+    cairo_paint(ctx->cairo);
+}
+
+/* Drop the display list, see wk_context_set_retained() */
+static void _forget_list(struct wk_context *ctx)
+{
+    if(ctx->list)
+        cairo_surface_destroy(ctx->list);
+    ctx->list = NULL;
+    ctx->recorded = false;
+}
+
+/* Repaint the context, clipped to the part of ctx->clip it covers */
+static void _draw_context(struct wk_context *ctx)
+{
+    struct wk_rect bounds = { ctx->x, ctx->y, ctx->width, ctx->height };
+    struct wk_region *repaint = ctx->clip;
+    struct wk_rect clip;
+
+    cairo_save(ctx->cairo);
+    for(int i = 0; i < repaint->count; i++) {
+        if(wk_rect_intersect(&repaint->rects[i], &bounds, &clip))
+            cairo_rectangle(ctx->cairo, clip.x - ctx->x, clip.y - ctx->y,
+                    clip.width, clip.height);
+    }
+    cairo_clip(ctx->cairo);
+
+    clockid_t clock = ctx->win->disp->clock;
+    uint64_t start = ctx->timing ? wk_clock_ns(clock) : 0;
+
+    if(ctx->retained)
+        _replay_context(ctx);
+    else {
+        struct wk_event draw = { .type = WKE_DRAW };
+        _deliver_event(ctx, &draw, ctx->cairo);
+    }
+
+    if(ctx->timing)
+        wk_hist_record(ctx->timing, wk_clock_ns(clock) - start);
+
+    cairo_restore(ctx->cairo);
+    cairo_surface_flush(ctx->surface);
+}
+
+static void _draw_job(void *data)
+{
+    _draw_context(data);
+}
+
+/* Contexts closer than pad may share a pixel of the buffer */
+static bool _overlaps(struct wk_context *a, struct wk_context *b, int pad)
+{
+    return a->x < b->x + b->width + pad && b->x < a->x + a->width + pad &&
+        a->y < b->y + b->height + pad && b->y < a->y + a->height + pad;
+}
+
+/* Add a bound context to the frame's draw list, clipped to clip */
+static void _queue_draw(struct wk_window *win, struct wk_context *ctx,
+        struct wk_region *clip, int *count)
+{
+    if(!ctx->cairo)
+        return;
+
+    if(*count == win->draw_cap) {
+        win->draw_cap = max(16, win->draw_cap * 2);
+        win->draw_list = failsafe(realloc(win->draw_list,
+                    win->draw_cap * sizeof(struct wk_context *)));
+        win->jobs = failsafe(realloc(win->jobs,
+                    win->draw_cap * sizeof(struct wk_job)));
+    }
+
+    if((win->flags & WKW_TIMING) && !ctx->timing)
+        ctx->timing = fzalloc(sizeof(struct wk_hist));
+
+    ctx->clip = clip;
+    win->draw_list[(*count)++] = ctx;
+}
+
+/* Draw the list, bottom first. With workers, contexts are split in
+ * waves: a context runs one wave after the last context below it that
+ * it overlaps, so non-overlapping ones draw concurrently and
+ * overlapping ones keep their layer order */
+static void _run_draws(struct wk_window *win, int count)
+{
+    struct wk_workers *workers = win->disp->workers;
+
+    if(!workers || count < 2) {
+        for(int i = 0; i < count; i++)
+            _draw_context(win->draw_list[i]);
+        return;
+    }
+
+    /* Scaled, neighbours can meet within a buffer pixel */
+    int pad = win->scaling.scale != WK_SCALE_ONE ? WK_SCALE_ONE : 0;
+    int waves = 0;
+    for(int i = 0; i < count; i++) {
+        struct wk_context *ctx = win->draw_list[i];
+        ctx->wave = 0;
+        for(int j = 0; j < i; j++) {
+            if(_overlaps(ctx, win->draw_list[j], pad))
+                ctx->wave = max(ctx->wave, win->draw_list[j]->wave + 1);
+        }
+        waves = max(waves, ctx->wave + 1);
+    }
+
+    for(int wave = 0; wave < waves; wave++) {
+        int jobs = 0;
+        for(int i = 0; i < count; i++) {
+            if(win->draw_list[i]->wave != wave)
+                continue;
+            win->jobs[jobs].func = _draw_job;
+            win->jobs[jobs].data = win->draw_list[i];
+            jobs++;
+        }
+        wk_workers_run(workers, win->jobs, jobs);
+    }
+}
+
+/* Repaint every context the grid finds under win->repaint, straight
+ * into the buffer */
+static void _draw_contexts(struct wk_window *win, struct wk_window_buffer *buf)
+{
+    struct wk_context **hits;
+    int count = 0;
+
+    int found = wk_grid_query(&win->grid, &win->repaint, &hits);
+    for(int i = 0; i < found; i++) {
+        if(hits[i]->plane)
+            continue;
+        _bind_context(hits[i], buf->id, buf->pixels, buf->stride, 0, 0,
+                buf->width, buf->height, win->scaling.scale);
+        _queue_draw(win, hits[i], &win->repaint, &count);
+    }
+
+    _run_draws(win, count);
+}
+
+/* (Re)allocate a layer cache at the window size, fully damaged */
+static void _size_layer(struct wk_window *win, struct wk_layer *cache)
+{
+    if(cache->width == win->width && cache->height == win->height)
+        return;
+
+    if(cache->cairo) {
+        cairo_destroy(cache->cairo);
+        cairo_surface_destroy(cache->surface);
+    }
+
+    cache->width = win->width;
+    cache->height = win->height;
+    cache->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            cache->width, cache->height);
+    cache->cairo = cairo_create(cache->surface);
+    cache->id = ++win->buffer_serial;
+
+    wk_region_clear(&cache->damage);
+    wk_region_add(&cache->damage, 0, 0, cache->width, cache->height);
+}
+
+/* The cache of a layer, kept sorted like the contexts */
+static struct wk_layer *_get_layer(struct wk_window *win, int layer)
+{
+    struct wk_layer *prev = NULL;
+    struct wk_layer *cache = win->layer_head;
+    while(cache && cache->layer < layer) {
+        prev = cache;
+        cache = cache->next;
+    }
+
+    if(cache && cache->layer == layer)
+        return cache;
+
+    struct wk_layer *new = fzalloc(sizeof(struct wk_layer));
+    new->layer = layer;
+    new->next = cache;
+    if(prev)
+        prev->next = new;
+    else
+        win->layer_head = new;
+
+    _size_layer(win, new);
+    return new;
+}
+
+static void _free_layers(struct wk_window *win)
+{
+    struct wk_layer *cache = win->layer_head;
+    while(cache != NULL) {
+        struct wk_layer *to_del = cache;
+        cache = cache->next;
 
         cairo_destroy(to_del->cairo);
         cairo_surface_destroy(to_del->surface);
-
-        ctx_head = ctx_head->next;
         free(to_del);
     }
+    win->layer_head = NULL;
 
-    free(win);
-    return;
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next)
+        ctx->cache = NULL;
 }
 
-struct wk_context* wk_window_context(struct wk_window *win, wk_context_func function,
-        int layer, int x, int y, int width, int height)
+/* Redraw the damaged parts of each layer's cache, leaving clean layers
+ * untouched */
+static void _draw_layers(struct wk_window *win)
 {
-    //TODO: Check that the window is big enough for the context?
+    struct wk_context **hits;
+    int count = 0;
 
-    struct wk_context *new = fzalloc(sizeof wk_context);
+    /* Contexts new to a cache have never been drawn into it */
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+        if(ctx->cache || ctx->plane)
+            continue;
 
-    new->win = win;
+        ctx->cache = _get_layer(win, ctx->layer);
+        wk_region_add(&ctx->cache->damage, ctx->x, ctx->y, ctx->width, ctx->height);
+    }
 
-    new->layer = layer;
-    new->x = x;
-    new->y = y;
-    new->width = width;
-    new->height = height;
+    for(struct wk_layer *cache = win->layer_head; cache != NULL; cache = cache->next) {
+        _size_layer(win, cache);
 
-    // Should create a surface with the right offset etc.
-    new->surface = cairo_image_surface_create_for_data(
-            win->buffer->pixels[((y * win->buffer->width) * 4) + (x * 4)],
-            CAIRO_FORMAT_ARGB32,
-            width,
-            height,
-            width * 4);
-    new->cairo = cairo_create(new->surface);
+        pthread_mutex_lock(&win->lock);
+        cache->redraw = cache->damage;
+        wk_region_clear(&cache->damage);
+        pthread_mutex_unlock(&win->lock);
+
+        wk_region_clip(&cache->redraw, cache->width, cache->height);
+        if(cache->redraw.count == 0)
+            continue;
 
-    //TODO: figure this out...
-    if(!win->context_head)
+        /* Clear what gets redrawn, contexts paint over transparency */
+        cairo_surface_flush(cache->surface);
+        for(int i = 0; i < cache->redraw.count; i++)
+            wk_pixel_clear_rect(cairo_image_surface_get_data(cache->surface),
+                    cairo_image_surface_get_stride(cache->surface),
+                    &cache->redraw.rects[i]);
 
-    struct wk_context *prev = win->context_head;
-    while((prev) && (layer < prev->layer)) {
-        prev = prev->next;
+        int found = wk_grid_query(&win->grid, &cache->redraw, &hits);
+        for(int i = 0; i < found; i++) {
+            if(hits[i]->layer != cache->layer || hits[i]->plane)
+                continue;
+
+            _bind_context(hits[i], cache->id,
+                    cairo_image_surface_get_data(cache->surface),
+                    cairo_image_surface_get_stride(cache->surface), 0, 0,
+                    cache->width, cache->height, WK_SCALE_ONE);
+            _queue_draw(win, hits[i], &cache->redraw, &count);
+        }
     }
 
-    if(prev) {
-        new->next = prev->next;
-        prev->next = new;
+    _run_draws(win, count);
+
+    for(struct wk_layer *cache = win->layer_head; cache != NULL; cache = cache->next)
+        cairo_surface_mark_dirty(cache->surface);
+}
+
+/* Blend the layer caches into the buffer over win->repaint, bottom first */
+static void _composite_layers(struct wk_window *win, struct wk_window_buffer *buf)
+{
+    for(int i = 0; i < win->repaint.count; i++) {
+        struct wk_rect *r = &win->repaint.rects[i];
+
+        if(!win->layer_head) {
+            wk_pixel_clear_rect(buf->pixels, buf->stride, r);
+            continue;
+        }
+
+        /* The bottom layer replaces what was there, the rest go over it */
+        for(struct wk_layer *cache = win->layer_head; cache != NULL; cache = cache->next) {
+            unsigned char *src = cairo_image_surface_get_data(cache->surface);
+            int stride = cairo_image_surface_get_stride(cache->surface);
+
+            if(cache == win->layer_head)
+                wk_pixel_copy_rect(buf->pixels, buf->stride, src, stride, r);
+            else
+                wk_pixel_over_rect(buf->pixels, buf->stride, src, stride, r);
+        }
+    }
+
+    cairo_surface_mark_dirty(buf->cairo_surface);
+}
+
+/* Clear the area about to be repainted so uncovered pixels don't linger */
+static void _clear_region(struct wk_window_buffer *buf, struct wk_region *reg)
+{
+    for(int i = 0; i < reg->count; i++)
+        wk_pixel_clear_rect(buf->pixels, buf->stride, &reg->rects[i]);
+    cairo_surface_mark_dirty(buf->cairo_surface);
+}
+
+/* Copy into buf whatever changed since it was last drawn, from the
+ * buffer shown last. False when buf has to be repainted instead */
+static bool _copy_forward(struct wk_window *win, struct wk_window_buffer *buf)
+{
+    struct wk_window_buffer *last = win->buffer;
+    if(!last || last->width != buf->width || last->height != buf->height ||
+            last->format != buf->format)
+        return false;
+
+    /* The pool may have moved since last was drawn */
+    if(last->generation != last->pool->generation)
+        _map_buffer(win, last);
+
+    /* Frames buf missed are the ones after buf->frame up to last */
+    uint64_t age = last->frame - buf->frame;
+    struct wk_region stale;
+    wk_region_clear(&stale);
+
+    if(buf->frame == 0 || age > WK_DAMAGE_HISTORY) {
+        wk_region_add(&stale, 0, 0, buf->width, buf->height);
     } else {
+        for(uint64_t f = buf->frame + 1; f <= last->frame; f++) {
+            struct wk_region *missed = &win->history[f % WK_DAMAGE_HISTORY];
+            for(int i = 0; i < missed->count; i++)
+                wk_region_add(&stale, missed->rects[i].x, missed->rects[i].y,
+                        missed->rects[i].width, missed->rects[i].height);
+        }
+    }
+
+    wk_region_clip(&stale, buf->width, buf->height);
+    for(int i = 0; i < stale.count; i++)
+        wk_pixel_copy_rect(buf->pixels, buf->stride, last->pixels, last->stride,
+                &stale.rects[i]);
+
+    cairo_surface_mark_dirty(buf->cairo_surface);
+    win->stats.copied_pixels += wk_region_area(&stale);
+    return true;
+}
+
+/* Tell the compositor what we cover opaquely, so it can skip blending
+ * there and cull what lies behind. wl_region unions overlaps exactly */
+static void _submit_opaque(struct wk_window *win)
+{
+    if(!win->opaque_dirty)
+        return;
+    win->opaque_dirty = false;
 
+    struct wl_region *region = wl_compositor_create_region(win->disp->compositor);
+    if(win->flags & WKW_OPAQUE) {
+        wl_region_add(region, 0, 0, win->width, win->height);
+    } else {
+        for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+            if(ctx->opaque && !ctx->plane)
+                wl_region_add(region, ctx->x, ctx->y, ctx->width, ctx->height);
+        }
     }
+
+    wl_surface_set_opaque_region(win->surface, region);
+    wl_region_destroy(region);
 }
 
-void wk_window_remove_context(struct wk_window *win, struct wk_context *remove)
+/* Tell the compositor which pixels changed since the last commit, as
+ * buffer pixels or, for older compositors, in surface coordinates */
+static void _submit_damage(struct wl_surface *surface, struct wk_region *pixels,
+        struct wk_region *damage)
 {
-    remove->prev = remove->next;
-    cairo_destroy(remove->cairo);
-    cairo_surface_destroy(remove->surface);
-    free(remove);
+    if(wl_surface_get_version(surface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION) {
+        for(int i = 0; i < pixels->count; i++) {
+            struct wk_rect *r = &pixels->rects[i];
+            wl_surface_damage_buffer(surface, r->x, r->y, r->width, r->height);
+        }
+        return;
+    }
+
+    for(int i = 0; i < damage->count; i++) {
+        struct wk_rect *r = &damage->rects[i];
+        wl_surface_damage(surface, r->x, r->y, r->width, r->height);
+    }
+}
+
+/* Have the compositor stretch scaled buffers over the window, and stop
+ * once they are full size again */
+static void _submit_viewport(struct wk_window *win)
+{
+    struct wk_window_scaling *scaling = &win->scaling;
+    if(!scaling->viewport)
+        return;
+
+    int32_t width = -1, height = -1;
+    if(scaling->scale != WK_SCALE_ONE) {
+        width = win->width;
+        height = win->height;
+    }
+
+    if(width == scaling->width && height == scaling->height)
+        return;
+    wp_viewport_set_destination(scaling->viewport, width, height);
+    scaling->width = width;
+    scaling->height = height;
+}
+
+/* Refresh period of the output's current mode */
+static uint64_t _frame_budget(struct wk_display *disp)
+{
+    for(struct wk_mode *mode = disp->mode_head; mode != NULL; mode = mode->next) {
+        if(mode->current && mode->refresh > 0)
+            return 1000000000000ULL / mode->refresh;
+    }
+    return WK_SCALE_BUDGET;
+}
+
+/* Timer of a paced window, its render is due */
+static void _handle_pace(struct wk_source *src, uint32_t events, void *data)
+{
+    wk_window_wake(data);
+}
+
+/* True when a paced render should start now. Otherwise the timer is set
+ * for the latest start that still makes a vblank, so input keeps coming
+ * in until then */
+static bool _pace(struct wk_window *win)
+{
+    struct wk_window_pacing *pacing = &win->pacing;
+    uint64_t now = wk_clock_ns(win->disp->clock);
+    uint64_t refresh = pacing->refresh ? pacing->refresh : _frame_budget(win->disp);
+    uint64_t lead = pacing->cost + WK_PACE_MARGIN;
+
+    /* Nothing to line up with yet */
+    if(!pacing->vblank) {
+        pacing->target = 0;
+        return true;
+    }
+
+    /* The first vblank we can still make */
+    uint64_t target = pacing->vblank;
+    if(target < now + lead)
+        target += (now + lead - target + refresh - 1) / refresh * refresh;
+    pacing->target = target;
+
+    uint64_t start = target - lead;
+    if(start <= now + WK_PACE_SLACK)
+        return true;
+
+    wk_loop_set_timer_ns(pacing->timer, start - now, 0);
+    return false;
+}
+
+/* Fold a paced render into the cost estimate. It grows at once and
+ * shrinks slowly, so one quick frame does not make the next one late */
+static void _account_pace(struct wk_window *win, uint64_t cost, uint64_t now)
+{
+    struct wk_window_pacing *pacing = &win->pacing;
+
+    if(cost > pacing->cost)
+        pacing->cost = cost;
+    else
+        pacing->cost -= (pacing->cost - cost) / 16;
+
+    if(!pacing->target)
+        return;
+
+    win->stats.paced++;
+    if(now + WK_PACE_MARGIN > pacing->target) {
+        win->stats.missed++;
+        vlog("paced render late by %llu us",
+                (unsigned long long) (now + WK_PACE_MARGIN - pacing->target) / 1000);
+    }
+    pacing->target = 0;
+}
+
+/* Timer of a scaled window that stopped rendering, nothing keeps its
+ * scale down anymore. The render it asks for restores it */
+static void _handle_scale_idle(struct wk_source *src, uint32_t events, void *data)
+{
+    struct wk_window *win = data;
+
+    atomic_store(&win->scaling.idle, true);
+
+    /* Threaded windows resize under the lock */
+    pthread_mutex_lock(&win->lock);
+    wk_region_add(&win->damage, 0, 0, win->width, win->height);
+    pthread_mutex_unlock(&win->lock);
+    wk_window_invalidate(win);
+}
+
+/* Back to the top scale after the window was idle, see WK_SCALE_IDLE */
+static void _restore_scale(struct wk_window *win)
+{
+    struct wk_window_scaling *scaling = &win->scaling;
+
+    if(!atomic_exchange(&scaling->idle, false) || scaling->scale >= scaling->max)
+        return;
+    if(win->flags & WKW_COMPOSITE)
+        return;
+
+    scaling->scale = scaling->max;
+    scaling->average = 0;
+    scaling->over = scaling->under = 0;
+    scaling->changes++;
+    vlog("window idle, scale back to %d/%d", scaling->max, WK_SCALE_ONE);
+}
+
+/* Pick the scale of the next buffers from how long renders take against
+ * the refresh period. It drops a step on a short run of slow frames and
+ * climbs back after a long run of fast ones, so it does not oscillate */
+static void _adapt_scale(struct wk_window *win, uint64_t cost)
+{
+    struct wk_window_scaling *scaling = &win->scaling;
+    uint64_t budget = _frame_budget(win->disp);
+    int scale = scaling->scale;
+    int next = scale;
+
+    /* Average over about the last 8 frames */
+    if(scaling->average)
+        scaling->average = scaling->average - scaling->average / 8 + cost / 8;
+    else
+        scaling->average = cost;
+
+    /* Render time follows the pixel count, so the square of the scale */
+    uint64_t up = scaling->average * (scale + 1) * (scale + 1) / (scale * scale);
+
+    if(scaling->average * 100 > budget * WK_SCALE_HIGH) {
+        scaling->under = 0;
+        if(++scaling->over >= WK_SCALE_DOWN_FRAMES)
+            next = max(scale - 1, scaling->min);
+    } else if(up * 100 < budget * WK_SCALE_LOW) {
+        scaling->over = 0;
+        if(++scaling->under >= WK_SCALE_UP_FRAMES)
+            next = min(scale + 1, scaling->max);
+    } else {
+        scaling->over = scaling->under = 0;
+    }
+
+    /* The next buffers are another size, they repaint in full */
+    if(next != scale) {
+        scaling->average = scaling->average * next * next / (scale * scale);
+        scaling->over = scaling->under = 0;
+        scaling->scale = next;
+        scaling->changes++;
+        vlog("window scale %d/%d", next, WK_SCALE_ONE);
+    }
+
+    /* Pushed back by every render, so it fires once they stop */
+    wk_loop_set_timer(scaling->idle_timer, next < scaling->max ? WK_SCALE_IDLE : 0, 0);
+}
+
+/* wl_callback listener for a plane's wl_surface.frame */
+static void _handle_plane_frame(void *data, struct wl_callback *wl_callback,
+        uint32_t time)
+{
+    struct wk_context *ctx = data;
+
+    wl_callback_destroy(wl_callback);
+    ctx->plane->frame_cb = NULL;
+
+    /* Damage that came in meanwhile waited for this */
+    pthread_mutex_lock(&ctx->win->lock);
+    bool pending = ctx->plane->damage.count > 0;
+    pthread_mutex_unlock(&ctx->win->lock);
+    if(pending)
+        wk_window_invalidate(ctx->win);
+}
+
+struct wl_callback_listener plane_frame_listener = {
+    .done = _handle_plane_frame
+};
+/* end wl_callback listener */
+
+/* A released buffer of the plane at the context's size */
+static struct wk_window_buffer *_plane_buffer(struct wk_window *win,
+        struct wk_context *ctx)
+{
+    struct wk_plane *plane = ctx->plane;
+
+    /* A plane only drops its alpha when its context is opaque */
+    uint32_t format = WL_SHM_FORMAT_ARGB8888;
+    if(ctx->opaque && wk_display_has_format(win->disp, WL_SHM_FORMAT_XRGB8888))
+        format = WL_SHM_FORMAT_XRGB8888;
+
+    for(int i = 0; i < plane->buffer_count; i++) {
+        struct wk_window_buffer *buf = plane->buffers[i];
+        if(buf->busy)
+            continue;
+        if(buf->width == (uint32_t) ctx->width && buf->height == (uint32_t) ctx->height &&
+                buf->format == format)
+            return buf;
+
+        /* The context was resized or changed opacity, busy buffers go
+         * once they are released */
+        plane->buffers[i--] = plane->buffers[--plane->buffer_count];
+        if(plane->buffer == buf)
+            plane->buffer = NULL;
+        _delete_buffer(buf);
+    }
+
+    if(plane->buffer_count == WK_PLANE_BUFFERS)
+        return NULL;
+
+    struct wk_window_buffer *buf = _create_buffer(win, ctx->width, ctx->height, format);
+    plane->buffers[plane->buffer_count++] = buf;
+    return buf;
+}
+
+/* Draw and commit the damage of a context on its own surface. True when
+ * the commit waits for the window's (WKS_SYNC) */
+static bool _render_plane(struct wk_window *win, struct wk_context *ctx)
+{
+    struct wk_plane *plane = ctx->plane;
+    if(plane->frame_cb || ctx->width <= 0 || ctx->height <= 0)
+        return false;
+
+    pthread_mutex_lock(&win->lock);
+    struct wk_window_buffer *buf = plane->damage.count ? _plane_buffer(win, ctx) : NULL;
+    if(!buf) {
+        pthread_mutex_unlock(&win->lock);
+        return false;
+    }
+
+    struct wk_region frame = plane->damage;
+    wk_region_clear(&plane->damage);
+    pthread_mutex_unlock(&win->lock);
+    wk_region_clip(&frame, ctx->width, ctx->height);
+
+    wk_shm_pool_lock(buf->pool);
+    if(buf->generation != buf->pool->generation)
+        _map_buffer(win, buf);
+
+    /* Planes are small, a rotated buffer takes all of the last one */
+    struct wk_window_buffer *last = plane->buffer;
+    struct wk_rect all = { 0, 0, ctx->width, ctx->height };
+    if(buf != last && last && last->width == buf->width && last->height == buf->height &&
+            last->format == buf->format) {
+        if(last->generation != last->pool->generation)
+            _map_buffer(win, last);
+        wk_pixel_copy_rect(buf->pixels, buf->stride, last->pixels, last->stride, &all);
+    } else if(buf != last) {
+        wk_region_clear(&frame);
+        wk_region_add(&frame, 0, 0, ctx->width, ctx->height);
+    }
+    _clear_region(buf, &frame);
+
+    /* Contexts draw with a window coordinates clip */
+    wk_region_clear(&plane->repaint);
+    for(int i = 0; i < frame.count; i++)
+        wk_region_add(&plane->repaint, frame.rects[i].x + ctx->x,
+                frame.rects[i].y + ctx->y, frame.rects[i].width, frame.rects[i].height);
+
+    _bind_context(ctx, buf->id, buf->pixels, buf->stride, ctx->x, ctx->y,
+            buf->width, buf->height, WK_SCALE_ONE);
+    if(ctx->cairo) {
+        ctx->clip = &plane->repaint;
+        _draw_context(ctx);
+    }
+
+    wl_surface_attach(plane->surface, buf->wl_buffer, 0, 0);
+    _submit_damage(plane->surface, &frame, &frame);
+    plane->frame_cb = wl_surface_frame(plane->surface);
+    wl_callback_add_listener(plane->frame_cb, &plane_frame_listener, ctx);
+    wl_surface_commit(plane->surface);
+    wk_shm_pool_unlock(buf->pool);
+
+    buf->busy = true;
+    plane->buffer = buf;
+    return plane->mode == WKS_SYNC;
+}
+
+/* Draw the contexts on their own surfaces, true if the window has to
+ * commit for what they did to show */
+static bool _render_planes(struct wk_window *win)
+{
+    bool commit = false;
+
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+        if(!ctx->plane)
+            continue;
+
+        /* Positions are applied with the window's commit */
+        if(ctx->plane->moved) {
+            wl_subsurface_set_position(ctx->plane->subsurface, ctx->x, ctx->y);
+            ctx->plane->moved = false;
+            commit = true;
+        }
+
+        if(_render_plane(win, ctx))
+            commit = true;
+    }
+
+    return commit;
+}
+
+static void _free_plane(struct wk_context *ctx)
+{
+    struct wk_plane *plane = ctx->plane;
+
+    /* Busy buffers are freed on release, from the display's queue since
+     * the window's may be gone by then */
+    for(int i = 0; i < plane->buffer_count; i++) {
+        if(plane->buffers[i]->busy) {
+            plane->buffers[i]->orphan = true;
+            wl_proxy_set_queue((struct wl_proxy *) plane->buffers[i]->wl_buffer, NULL);
+        } else
+            _delete_buffer(plane->buffers[i]);
+    }
+
+    if(plane->frame_cb)
+        wl_callback_destroy(plane->frame_cb);
+    wl_subsurface_destroy(plane->subsurface);
+    wl_surface_destroy(plane->surface);
+    free(plane);
+
+    ctx->plane = NULL;
+    _unbind_context(ctx);
+}
+
+struct wk_window *wk_window_create(struct wk_display *disp, int width, int height)
+{
+    failsafe(disp);
+
+    struct wk_window *win = fzalloc(sizeof(struct wk_window));
+    win->disp = disp;
+    win->queue = wl_display_create_queue(disp->display);
+
+    /* Our events go to our queue, proxies made from these inherit it */
+    win->surface = wl_compositor_create_surface(disp->compositor);
+    wl_proxy_set_queue((struct wl_proxy *) win->surface, win->queue);
+    win->zxdg_surface = zxdg_shell_v6_get_xdg_surface(disp->shell, win->surface);
+    win->zxdg_toplevel = zxdg_surface_v6_get_toplevel(win->zxdg_surface);
+    wl_surface_set_user_data(win->surface, win);
+    win->buffer_limit = WK_MAX_BUFFERS;
+    win->scaling.scale = WK_SCALE_ONE;
+    pthread_mutex_init(&win->lock, NULL);
+    pthread_mutex_init(&win->wake_lock, NULL);
+    pthread_cond_init(&win->wake, NULL);
+    wk_grid_init(&win->grid, width, height);
+
+    zxdg_surface_v6_add_listener(win->zxdg_surface, &zxdg_surface_listener, win);
+    zxdg_toplevel_v6_add_listener(win->zxdg_toplevel, &zxdg_toplevel_listener, win);
+
+    /* Push to the top of the display's window list */
+    win->next = disp->window_head;
+    disp->window_head = win;
+
+    win->width = width;
+    win->height = height;
+
+    wl_surface_commit(win->surface);
+
+    nlog("window created");
+    return win;
+}
+
+/* Apply the latest configure before drawing, under win->lock */
+static void _apply_configure(struct wk_window *win)
+{
+    if(win->pending_width > 0 && win->pending_height > 0) {
+        win->width = win->pending_width;
+        win->height = win->pending_height;
+    }
+
+    /* Buffers catch up with the size in _next_buffer() */
+    if(win->width != win->grid.width || win->height != win->grid.height || !win->configured) {
+        wk_region_add(&win->damage, 0, 0, win->width, win->height);
+        wk_grid_rebuild(&win->grid, win->width, win->height, win->context_head);
+    }
+
+    win->configured = true;
+    win->opaque_dirty = true;
+    win->configure_pending = false;
+    win->configure_ack = true;
+}
+
+/* Dispatch the window's queue and render if it is due */
+void wk_window_dispatch(struct wk_window *win)
+{
+    wl_display_dispatch_queue_pending(win->disp->display, win->queue);
+
+    if(!wk_window_ready(win))
+        return;
+
+    /* Paced windows render as late as they can afford */
+    if((win->flags & WKW_PACED) && !_pace(win))
+        return;
+    wk_window_render(win);
+}
+
+static void *_window_main(void *data)
+{
+    struct wk_window *win = data;
+
+    pthread_mutex_lock(&win->wake_lock);
+    while(!win->stop) {
+        if(!win->woken) {
+            pthread_cond_wait(&win->wake, &win->wake_lock);
+            continue;
+        }
+
+        win->woken = false;
+        pthread_mutex_unlock(&win->wake_lock);
+
+        wk_window_dispatch(win);
+
+        /* The loop waits for EPOLLOUT on our behalf when the socket is full */
+        if(wl_display_flush(win->disp->display) < 0 && errno == EAGAIN)
+            wk_loop_wakeup(win->disp->loop);
+
+        pthread_mutex_lock(&win->wake_lock);
+    }
+    pthread_mutex_unlock(&win->wake_lock);
+
+    return NULL;
+}
+
+/* Have the window dispatch its events and render on its own thread, while
+ * the display loop only reads. Contexts are best added, moved and removed
+ * from their callbacks once it runs */
+void wk_window_set_threaded(struct wk_window *win, bool enable)
+{
+    if(enable == win->threaded)
+        return;
+
+    if(enable) {
+        win->stop = false;
+        win->woken = true;
+        if(pthread_create(&win->thread, NULL, _window_main, win) != 0) {
+            nlog(red("Could not start a window thread"));
+            return;
+        }
+        win->threaded = true;
+        return;
+    }
+
+    pthread_mutex_lock(&win->wake_lock);
+    win->stop = true;
+    pthread_cond_signal(&win->wake);
+    pthread_mutex_unlock(&win->wake_lock);
+
+    pthread_join(win->thread, NULL);
+    win->threaded = false;
+}
+
+/* Get the window's events and render requests looked at, by its thread
+ * or by the display loop */
+void wk_window_wake(struct wk_window *win)
+{
+    if(!win->threaded) {
+        wk_loop_wakeup(win->disp->loop);
+        return;
+    }
+
+    pthread_mutex_lock(&win->wake_lock);
+    win->woken = true;
+    pthread_cond_signal(&win->wake);
+    pthread_mutex_unlock(&win->wake_lock);
+}
+
+/* Start renders as late as they can while still making the next vblank,
+ * instead of right after the frame callback. That takes up to a frame of
+ * latency off input. Vblanks come from presentation feedback, or from
+ * the output's refresh rate and frame callbacks without wp_presentation */
+void wk_window_set_paced(struct wk_window *win, bool enable)
+{
+    struct wk_window_pacing *pacing = &win->pacing;
+    if(enable == !!(win->flags & WKW_PACED))
+        return;
+
+    if(enable) {
+        pacing->timer = wk_loop_add_timer(win->disp->loop, 0, 0, _handle_pace, win);
+        win->flags |= WKW_PACED;
+        return;
+    }
+
+    win->flags &= ~WKW_PACED;
+    wk_loop_remove(win->disp->loop, pacing->timer);
+    memset(pacing, 0, sizeof(struct wk_window_pacing));
+
+    /* A render put off for the timer is due now */
+    wk_window_wake(win);
+}
+
+/* Keep frame timing histograms, see struct wk_window_timing */
+void wk_window_set_timing(struct wk_window *win, bool enable)
+{
+    if(enable && !win->timing) {
+        win->timing = fzalloc(sizeof(struct wk_window_timing));
+        win->flags |= WKW_TIMING;
+        return;
+    }
+
+    if(enable || !win->timing)
+        return;
+
+    win->flags &= ~WKW_TIMING;
+    free(win->timing);
+    win->timing = NULL;
+
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+        free(ctx->timing);
+        ctx->timing = NULL;
+    }
+}
+
+/* Print the timing histograms, one line each */
+void wk_window_print_timing(struct wk_window *win, FILE *out)
+{
+    struct wk_window_timing *timing = win->timing;
+    if(!timing)
+        return;
+
+    fprintf(out, "window %p (%dx%d), %llu frames, %llu discarded\n", (void *) win,
+            win->width, win->height, (unsigned long long) win->stats.frames,
+            (unsigned long long) timing->discarded);
+    wk_hist_print(&timing->render, "render", out);
+    wk_hist_print(&timing->interval, "commit interval", out);
+    wk_hist_print(&timing->wait, "buffer wait", out);
+    wk_hist_print(&timing->present, "commit to present", out);
+    if(win->flags & WKW_PACED)
+        fprintf(out, "paced %llu, missed %llu, shown late %llu, cost %.1f us\n",
+                (unsigned long long) win->stats.paced,
+                (unsigned long long) win->stats.missed,
+                (unsigned long long) win->stats.late, win->pacing.cost / 1000.0);
+    if(win->flags & WKW_SCALING)
+        fprintf(out, "scale %d/%d, changed %llu times\n", win->scaling.scale,
+                WK_SCALE_ONE, (unsigned long long) win->scaling.changes);
+
+    char name[64];
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+        if(!ctx->timing)
+            continue;
+        snprintf(name, sizeof(name), "context %llu layer %d",
+                (unsigned long long) ctx->order, ctx->layer);
+        wk_hist_print(ctx->timing, name, out);
+    }
+}
+
+/* Promise every pixel of the window is painted opaque. Buffers go
+ * XRGB8888 when the compositor has it, and the whole surface is marked
+ * opaque */
+void wk_window_set_opaque(struct wk_window *win, bool enable)
+{
+    if(enable)
+        win->flags |= WKW_OPAQUE;
+    else
+        win->flags &= ~WKW_OPAQUE;
+
+    win->opaque_dirty = true;
+    wk_window_damage(win, 0, 0, win->width, win->height);
+}
+
+/* Cap the number of buffers the swapchain may allocate */
+void wk_window_set_buffer_limit(struct wk_window *win, int limit)
+{
+    win->buffer_limit = max(1, min(limit, WK_MAX_BUFFERS));
+}
+
+/* Keep spare room in buffers so resizing mostly reuses them, see
+ * _create_buffer(). Takes effect as buffers get reallocated */
+void wk_window_set_elastic(struct wk_window *win, bool enable)
+{
+    if(enable)
+        win->flags |= WKW_ELASTIC;
+    else
+        win->flags &= ~WKW_ELASTIC;
+}
+
+/* Request a render, it happens on the next frame callback */
+void wk_window_invalidate(struct wk_window *win)
+{
+    /* Both are atomic, producers may live on other threads. The first
+     * request wakes the loop in case it sleeps */
+    atomic_fetch_add(&win->stats.requests, 1);
+    if(!atomic_exchange(&win->dirty, true))
+        wk_window_wake(win);
+}
+
+/* Draw each layer into a retained surface and blend them on render, so
+ * layers that did not change cost a blend instead of a redraw */
+void wk_window_set_composite(struct wk_window *win, bool enable)
+{
+    /* Layer caches are at the window size, they never scale */
+    if(enable) {
+        win->flags |= WKW_COMPOSITE;
+        win->scaling.scale = WK_SCALE_ONE;
+    } else {
+        win->flags &= ~WKW_COMPOSITE;
+        _free_layers(win);
+    }
+
+    wk_window_damage(win, 0, 0, win->width, win->height);
+}
+
+/* Render into smaller buffers when frames run over the refresh period,
+ * and have the compositor scale them up through wp_viewporter. The scale
+ * stays between low and high, in steps of 1 / WK_SCALE_ONE, so a high
+ * below 1 always renders scaled. A window that stops rendering goes
+ * back to high, see WK_SCALE_IDLE. Windows with WKW_COMPOSITE stay at
+ * full size */
+void wk_window_set_scaling(struct wk_window *win, bool enable, double low, double high)
+{
+    struct wk_window_scaling *scaling = &win->scaling;
+
+    if(enable && !win->disp->viewporter) {
+        nlog("no wp_viewporter, the window renders at full size");
+        return;
+    }
+
+    if(enable) {
+        scaling->min = min(max((int) (low * WK_SCALE_ONE + 0.5), 1), WK_SCALE_ONE);
+        scaling->max = min(max((int) (high * WK_SCALE_ONE + 0.5), scaling->min), WK_SCALE_ONE);
+        if(!scaling->viewport) {
+            scaling->viewport = wp_viewporter_get_viewport(win->disp->viewporter,
+                    win->surface);
+            scaling->width = scaling->height = -1;
+        }
+        if(!scaling->idle_timer)
+            scaling->idle_timer = wk_loop_add_timer(win->disp->loop, 0, 0,
+                    _handle_scale_idle, win);
+
+        win->flags |= WKW_SCALING;
+        scaling->scale = (win->flags & WKW_COMPOSITE) ? WK_SCALE_ONE : scaling->max;
+    } else {
+        /* Without a viewport the next commit is unscaled */
+        if(scaling->viewport)
+            wp_viewport_destroy(scaling->viewport);
+        scaling->viewport = NULL;
+        if(scaling->idle_timer)
+            wk_loop_remove(win->disp->loop, scaling->idle_timer);
+        scaling->idle_timer = NULL;
+
+        win->flags &= ~WKW_SCALING;
+        scaling->scale = WK_SCALE_ONE;
+    }
+
+    scaling->average = 0;
+    scaling->over = scaling->under = 0;
+    atomic_store(&scaling->idle, false);
+    wk_window_damage(win, 0, 0, win->width, win->height);
+}
+
+/* Mark a rectangle of the window as changed and request a render */
+void wk_window_damage(struct wk_window *win, int32_t x, int32_t y,
+        int32_t width, int32_t height)
+{
+    /* Contexts may invalidate from render workers */
+    pthread_mutex_lock(&win->lock);
+    wk_region_add(&win->damage, x, y, width, height);
+    pthread_mutex_unlock(&win->lock);
+
+    wk_window_invalidate(win);
+}
+
+/* True when the window is dirty and the compositor is ready for a frame */
+bool wk_window_ready(struct wk_window *win)
+{
+    return (win->configured || win->configure_pending) && win->dirty && !win->frame_cb;
+}
+
+/* Draw the damaged contexts and commit, false if no buffer was free */
+bool wk_window_render(struct wk_window *win)
+{
+    struct wk_window_timing *timing = win->timing;
+    bool timed = timing || (win->flags & (WKW_SCALING | WKW_PACED));
+    uint64_t start = timed ? wk_clock_ns(win->disp->clock) : 0;
+
+    if(win->flags & WKW_SCALING)
+        _restore_scale(win);
+
+    /* Let contexts react to their events, they invalidate what changed */
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next)
+        _dispatch_context(ctx);
+
+    /* Contexts on their own surfaces commit on their own */
+    bool planes = _render_planes(win);
+
+    pthread_mutex_lock(&win->lock);
+    if(win->configure_pending)
+        _apply_configure(win);
+
+    struct wk_region *damage = &win->damage;
+    wk_region_clip(damage, win->width, win->height);
+    if(damage->count == 0) {
+        win->dirty = false;
+        pthread_mutex_unlock(&win->lock);
+
+        /* Nothing to draw, but the configure still wants its ack and
+         * synchronized planes their parent commit */
+        if(win->configure_ack) {
+            zxdg_surface_v6_ack_configure(win->zxdg_surface, win->configure_serial);
+            win->configure_ack = false;
+            planes = true;
+        }
+        if(planes)
+            wl_surface_commit(win->surface);
+        return true;
+    }
+
+    struct wk_window_buffer *buf = _next_buffer(win);
+    if(!buf) {
+        pthread_mutex_unlock(&win->lock);
+        if(timing && !timing->wait_start)
+            timing->wait_start = start;
+        return false;
+    }
+
+    if(timing && timing->wait_start) {
+        wk_hist_record(&timing->wait, start - timing->wait_start);
+        timing->wait_start = 0;
+    }
+
+    /* Anything invalidated from here on waits for the next frame */
+    struct wk_region frame = *damage;
+    wk_region_clear(damage);
+    win->dirty = false;
+    pthread_mutex_unlock(&win->lock);
+
+    /* Scaled, the frame goes to whole buffer pixels */
+    struct wk_region pixels, clear;
+    _align_region(win, &frame);
+    _scale_region(win, &frame, &pixels);
+    wk_region_clip(&pixels, buf->width, buf->height);
+
+    /* Other windows may grow the pool, not while we draw into it */
+    wk_shm_pool_lock(buf->pool);
+    if(buf->generation != buf->pool->generation)
+        _map_buffer(win, buf);
+
+    /* A buffer other than the last one shown is behind, bring it up to
+     * date before drawing this frame's damage */
+    win->repaint = frame;
+    if(buf != win->buffer && !_copy_forward(win, buf)) {
+        wk_region_clear(&win->repaint);
+        wk_region_add(&win->repaint, 0, 0, win->width, win->height);
+    }
+
+    if(win->flags & WKW_COMPOSITE) {
+        _draw_layers(win);
+        _composite_layers(win, buf);
+    } else {
+        _scale_region(win, &win->repaint, &clear);
+        _clear_region(buf, &clear);
+        _draw_contexts(win, buf);
+    }
+
+    /* Only what actually changed goes to the compositor */
+    wl_surface_attach(win->surface, buf->wl_buffer, 0, 0);
+    _submit_viewport(win);
+    _submit_opaque(win);
+    _submit_damage(win->surface, &pixels, &frame);
+
+    /* The buffer has the configured size, the commit goes with the ack */
+    if(win->configure_ack) {
+        zxdg_surface_v6_ack_configure(win->zxdg_surface, win->configure_serial);
+        win->configure_ack = false;
+    }
+
+    /* At most one commit per refresh, see _handle_frame_done */
+    win->frame_cb = wl_surface_frame(win->surface);
+    wl_callback_add_listener(win->frame_cb, &frame_listener, win);
+    /* Frames are timed up to the commit going out */
+    uint64_t now = timed ? wk_clock_ns(win->disp->clock) : 0;
+    if((timing || (win->flags & WKW_PACED)) && win->disp->presentation) {
+        struct wk_feedback *fb = failsafe(wk_slab_alloc(&_feedback_slab));
+        fb->win = win;
+        fb->commit = now;
+        fb->target = win->pacing.target;
+        fb->wp_feedback = wp_presentation_feedback(win->disp->presentation, win->surface);
+        wl_proxy_set_queue((struct wl_proxy *) fb->wp_feedback, win->queue);
+        wp_presentation_feedback_add_listener(fb->wp_feedback, &feedback_listener, fb);
+
+        fb->next = win->feedback_head;
+        win->feedback_head = fb;
+    }
+
+    wl_surface_commit(win->surface);
+    wk_shm_pool_unlock(buf->pool);
+
+    if(timing) {
+        if(timing->commit)
+            wk_hist_record(&timing->interval, now - timing->commit);
+        wk_hist_record(&timing->render, now - start);
+        timing->commit = now;
+    }
+
+    if(win->flags & WKW_PACED)
+        _account_pace(win, now - start, now);
+    if((win->flags & WKW_SCALING) && !(win->flags & WKW_COMPOSITE))
+        _adapt_scale(win, now - start);
+
+    win->stats.frame_damage = wk_region_area(&pixels);
+    win->stats.frame_pixels = (int64_t) buf->width * buf->height;
+    win->stats.damage_pixels += win->stats.frame_damage;
+    win->stats.total_pixels += win->stats.frame_pixels;
+
+    /* Remember what this frame changed for buffers that come back later */
+    win->stats.frames++;
+    win->history[win->stats.frames % WK_DAMAGE_HISTORY] = pixels;
+    buf->frame = win->stats.frames;
+    buf->busy = true;
+    win->buffer = buf;
+    return true;
+}
+
+void wk_window_destroy(struct wk_window *win)
+{
+    wk_window_set_threaded(win, false);
+    wk_window_set_paced(win, false);
+    if(win->scaling.idle_timer)
+        wk_loop_remove(win->disp->loop, win->scaling.idle_timer);
+
+    /* WAYKIT_TIMING=<file> collects the timing of every window */
+    const char *path = getenv("WAYKIT_TIMING");
+    FILE *out = win->timing && path ? fopen(path, "a") : NULL;
+    if(out) {
+        wk_window_print_timing(win, out);
+        fclose(out);
+    }
+    wk_event_forget(win->disp, win, NULL);
+
+    struct wk_context *ctx_head = win->context_head;
+    while(ctx_head != NULL) {
+        struct wk_context *to_del = ctx_head;
+        ctx_head = ctx_head->next;
+        wk_window_remove_context(win, to_del);
+    }
+
+    /* Released buffers are gone, busy ones are freed on release from
+     * the display's queue once ours is gone */
+    for(int i = 0; i < win->buffer_count; i++) {
+        if(win->buffers[i]->busy)
+            wl_proxy_set_queue((struct wl_proxy *) win->buffers[i]->wl_buffer, NULL);
+    }
+    _reset_swapchain(win);
+
+    if(win->frame_cb)
+        wl_callback_destroy(win->frame_cb);
+
+    if(win->scaling.viewport)
+        wp_viewport_destroy(win->scaling.viewport);
+    zxdg_toplevel_v6_destroy(win->zxdg_toplevel);
+    zxdg_surface_v6_destroy(win->zxdg_surface);
+    wl_surface_destroy(win->surface);
+
+    struct wk_window **link = &win->disp->window_head;
+    while(*link != win)
+        link = &(*link)->next;
+    *link = win->next;
+
+    _free_layers(win);
+    wk_window_set_timing(win, false);
+    while(win->feedback_head != NULL)
+        _drop_feedback(win->feedback_head);
+    wl_event_queue_destroy(win->queue);
+    pthread_cond_destroy(&win->wake);
+    pthread_mutex_destroy(&win->wake_lock);
+    pthread_mutex_destroy(&win->lock);
+    wk_grid_free(&win->grid);
+    free(win->draw_list);
+    free(win->jobs);
+    free(win->batch);
+    free(win);
+
+    /* The last window gives the pages back */
+    wk_slab_trim(&_context_slab);
+    wk_slab_trim(&_feedback_slab);
+    wk_event_trim();
+}
+
+struct wk_context* wk_window_context(struct wk_window *win, wk_context_func function,
+        int layer, int x, int y, int width, int height)
+{
+    struct wk_context *new = failsafe(wk_slab_alloc(&_context_slab));
+
+    new->win = win;
+    new->callback = function;
+    new->scale = 1.0;
+
+    new->layer = layer;
+    new->x = x;
+    new->y = y;
+    new->width = width;
+    new->height = height;
+    new->order = ++win->context_serial;
+    wk_event_ring_init(&new->queue, WK_EVENT_RING, WKQ_DROP_OLDEST);
+
+    /* Surfaces are bound to a buffer at render time */
+    struct wk_event begin = { .type = WKE_BEGIN };
+    wk_event_enqueue(new, &begin);
+    wk_context_invalidate(new);
+
+    /* Insert after the last context of a lower or equal layer */
+    struct wk_context *prev = NULL;
+    struct wk_context *next = win->context_head;
+    while((next) && (next->layer <= layer)) {
+        prev = next;
+        next = next->next;
+    }
+
+    /* The display loop hit-tests the grid while delivering input */
+    pthread_mutex_lock(&win->lock);
+    new->prev = prev;
+    new->next = next;
+    if(next)
+        next->prev = new;
+    if(prev)
+        prev->next = new;
+    else
+        win->context_head = new;
+
+    wk_grid_insert(&win->grid, new);
+    pthread_mutex_unlock(&win->lock);
+    return new;
+}
+
+/* Move or resize a context, repainting where it was and where it goes */
+void wk_window_move_context(struct wk_window *win, struct wk_context *ctx,
+        int x, int y, int width, int height)
+{
+    /* Only the area changes, a display list holds unless it is resized.
+     * A plane is repositioned, and repainted only when resized */
+    if(ctx->plane) {
+        ctx->plane->moved = true;
+        if(width != ctx->width || height != ctx->height) {
+            pthread_mutex_lock(&win->lock);
+            wk_region_add(&ctx->plane->damage, 0, 0, width, height);
+            pthread_mutex_unlock(&win->lock);
+        }
+        wk_window_invalidate(win);
+    } else {
+        _damage_context(ctx, ctx->x, ctx->y, ctx->width, ctx->height);
+    }
+    if(width != ctx->width || height != ctx->height)
+        ctx->recorded = false;
+
+    pthread_mutex_lock(&win->lock);
+    wk_grid_remove(&win->grid, ctx);
+
+    ctx->x = x;
+    ctx->y = y;
+    ctx->width = width;
+    ctx->height = height;
+
+    wk_grid_insert(&win->grid, ctx);
+    pthread_mutex_unlock(&win->lock);
+    if(ctx->opaque)
+        win->opaque_dirty = true;
+    if(ctx->plane)
+        return;
+
+    _unbind_context(ctx);
+    _damage_context(ctx, ctx->x, ctx->y, ctx->width, ctx->height);
+}
+
+void wk_window_remove_context(struct wk_window *win, struct wk_context *remove)
+{
+    struct wk_event end = { .type = WKE_END };
+    if(remove->callback || remove->batch)
+        _deliver_event(remove, &end, NULL);
+
+    /* Out of the grid before the pointer forgets it, so the display loop
+     * can't hit-test it again while it is freed */
+    pthread_mutex_lock(&win->lock);
+    if(remove->prev)
+        remove->prev->next = remove->next;
+    else
+        win->context_head = remove->next;
+    if(remove->next)
+        remove->next->prev = remove->prev;
+    wk_grid_remove(&win->grid, remove);
+    pthread_mutex_unlock(&win->lock);
+    wk_event_forget(win->disp, win, remove);
+    if(remove->opaque)
+        win->opaque_dirty = true;
+
+    /* Whatever was under it shows again */
+    if(remove->plane)
+        _free_plane(remove);
+    wk_context_invalidate(remove);
+
+    _unbind_context(remove);
+    _forget_list(remove);
+    wk_event_ring_free(&remove->queue);
+    free(remove->held);
+    free(remove->timing);
+    wk_slab_free(&_context_slab, remove);
+}
+
+/* Damage a rectangle of the context (window coordinates) in its layer
+ * cache, if it has one, and in the window */
+static void _damage_context(struct wk_context *ctx, int32_t x, int32_t y,
+        int32_t width, int32_t height)
+{
+    /* A plane only repaints itself, in its own coordinates */
+    if(ctx->plane) {
+        pthread_mutex_lock(&ctx->win->lock);
+        wk_region_add(&ctx->plane->damage, x - ctx->x, y - ctx->y, width, height);
+        pthread_mutex_unlock(&ctx->win->lock);
+        wk_window_invalidate(ctx->win);
+        return;
+    }
+
+    if(ctx->cache) {
+        pthread_mutex_lock(&ctx->win->lock);
+        wk_region_add(&ctx->cache->damage, x, y, width, height);
+        pthread_mutex_unlock(&ctx->win->lock);
+    }
+
+    wk_window_damage(ctx->win, x, y, width, height);
+}
+
+/* Repaint the whole context on the next frame */
+void wk_context_invalidate(struct wk_context *ctx)
+{
+    ctx->recorded = false;
+    _damage_context(ctx, ctx->x, ctx->y, ctx->width, ctx->height);
+}
+
+/* Have the context take its pending events in runs of consecutive events
+ * of one type, with one call per run instead of one per event. It replaces the context's per
+ * event function, which may then be NULL. Set it before the window
+ * renders the context, or WKE_BEGIN goes to the per event function */
+void wk_context_set_batch(struct wk_context *ctx, wk_context_batch_func batch)
+{
+    ctx->batch = batch;
+    wk_window_invalidate(ctx->win);
+}
+
+/* Give the context its own wl_surface placed over the window with a
+ * wl_subsurface, so it commits and uploads without the window. With
+ * WKS_SYNC its frames show with the window's next commit, with
+ * WKS_DESYNC right away. WKS_NONE draws it into the window again.
+ * A plane stacks above every context the window draws, whatever its
+ * layer, and above the planes made before it */
+void wk_context_set_subsurface(struct wk_context *ctx, int mode)
+{
+    struct wk_window *win = ctx->win;
+    struct wk_display *disp = win->disp;
+
+    if(mode == WKS_NONE) {
+        if(ctx->plane)
+            _free_plane(ctx);
+        wk_context_invalidate(ctx);
+        return;
+    }
+
+    if(!disp->subcompositor) {
+        nlog("no wl_subcompositor, the context stays in the window");
+        return;
+    }
+
+    if(!ctx->plane) {
+        /* The window stops drawing it, what is under it shows there */
+        wk_context_invalidate(ctx);
+        _unbind_context(ctx);
+
+        struct wk_plane *plane = fzalloc(sizeof(struct wk_plane));
+        plane->surface = wl_compositor_create_surface(disp->compositor);
+        wl_proxy_set_queue((struct wl_proxy *) plane->surface, win->queue);
+        wl_surface_set_user_data(plane->surface, win);
+        plane->subsurface = wl_subcompositor_get_subsurface(disp->subcompositor,
+                plane->surface, win->surface);
+        plane->moved = true;
+        ctx->plane = plane;
+    }
+
+    ctx->plane->mode = mode;
+    if(mode == WKS_SYNC)
+        wl_subsurface_set_sync(ctx->plane->subsurface);
+    else
+        wl_subsurface_set_desync(ctx->plane->subsurface);
+    wk_context_invalidate(ctx);
+}
+
+/* Window coordinates of the origin of one of the window's surfaces, for
+ * input that arrives relative to a plane */
+void wk_window_surface_origin(struct wk_window *win, struct wl_surface *surface,
+        int *x, int *y)
+{
+    *x = *y = 0;
+    pthread_mutex_lock(&win->lock);
+    for(struct wk_context *ctx = win->context_head; ctx != NULL; ctx = ctx->next) {
+        if(ctx->plane && ctx->plane->surface == surface) {
+            *x = ctx->x;
+            *y = ctx->y;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&win->lock);
+}
+
+/* Record the context's drawing once and replay it when it is exposed,
+ * moved or uncovered. The callback only draws again after the context
+ * invalidates itself */
+void wk_context_set_retained(struct wk_context *ctx, bool retained)
+{
+    if(!retained)
+        _forget_list(ctx);
+    ctx->retained = retained;
+}
+
+/* Promise the context paints its whole rectangle opaque, the window's
+ * opaque region follows the opaque contexts */
+void wk_context_set_opaque(struct wk_context *ctx, bool opaque)
+{
+    if(ctx->opaque == opaque)
+        return;
+
+    ctx->opaque = opaque;
+    ctx->win->opaque_dirty = true;
+    wk_context_invalidate(ctx);
+}
+
+/* Repaint part of the context, in the context's own coordinates */
+void wk_context_invalidate_rect(struct wk_context *ctx, int32_t x, int32_t y,
+        int32_t width, int32_t height)
+{
+    struct wk_rect bounds = { 0, 0, ctx->width, ctx->height };
+    struct wk_rect rect = { x, y, width, height };
+
+    /* A display list is recorded whole, the repaint stays partial */
+    ctx->recorded = false;
+    if(wk_rect_intersect(&rect, &bounds, &rect))
+        _damage_context(ctx, ctx->x + rect.x, ctx->y + rect.y,
+                rect.width, rect.height);
 }
@@ -2,27 +2,206 @@
 #define WK_WINDOW_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <wayland-client.h>
 #include <cairo/cairo.h>
 #include "xdg-shell-unstable-v6.h"
+#include "presentation-time.h"
 #include "display.h"
 #include "event.h"
+#include "region.h"
+#include "shm.h"
+#include "worker.h"
+#include "grid.h"
+#include "hist.h"
+
+/* Maximum number of buffers in a window's swapchain */
+#define WK_MAX_BUFFERS  3
+
+/* Buffers of a context's own surface, see wk_context_set_subsurface */
+#define WK_PLANE_BUFFERS    2
+
+/* Subsurface modes of a context */
+#define WKS_NONE    0   /* Drawn into the window's buffers */
+#define WKS_SYNC    1   /* Own surface, shown with the window's next commit */
+#define WKS_DESYNC  2   /* Own surface, shown as soon as it commits */
+
+/* Frames of damage kept to bring returning buffers up to date */
+#define WK_DAMAGE_HISTORY   4
+
+/* Scale factors go in steps of 1 / WK_SCALE_ONE, see wk_window_set_scaling */
+#define WK_SCALE_ONE        8
+
+/* Scaling drops a step after WK_SCALE_DOWN_FRAMES renders averaging over
+ * WK_SCALE_HIGH percent of the refresh period, and climbs one after
+ * WK_SCALE_UP_FRAMES where the step up is expected under WK_SCALE_LOW */
+#define WK_SCALE_HIGH       85
+#define WK_SCALE_LOW        60
+#define WK_SCALE_DOWN_FRAMES    4
+#define WK_SCALE_UP_FRAMES      60
+
+/* A window below its top scale that renders nothing for WK_SCALE_IDLE
+ * milliseconds goes back to it with one full repaint */
+#define WK_SCALE_IDLE       250
+
+/* Refresh period assumed until the output tells, in nanoseconds */
+#define WK_SCALE_BUDGET     16666667
+
+/* Paced renders start their expected cost plus WK_PACE_MARGIN before
+ * the vblank they aim for, the margin leaving the compositor time to
+ * take the commit. Renders due within WK_PACE_SLACK start right away */
+#define WK_PACE_MARGIN      2000000
+#define WK_PACE_SLACK       500000
+
+/* Window flags */
+#define WKW_COMPOSITE   (1 << 0) /* Retain each layer, see wk_window_set_composite */
+#define WKW_ELASTIC     (1 << 1) /* Spare buffer room, see wk_window_set_elastic */
+#define WKW_TIMING      (1 << 2) /* Frame timing, see wk_window_set_timing */
+#define WKW_OPAQUE      (1 << 3) /* No transparency, see wk_window_set_opaque */
+#define WKW_SCALING     (1 << 4) /* Render below the window size, see wk_window_set_scaling */
+#define WKW_PACED       (1 << 5) /* Render late for the vblank, see wk_window_set_paced */
 
 /* A buffer struct that is used internally */
 struct wk_window_buffer {
-    uint32_t width, height;
+    uint32_t id;
+    /* Current size, stride and size cover the room it was allocated with */
+    uint32_t width, height, stride;
+    size_t size;
+    uint32_t format;
+
+    /* Frame last drawn into it, its age is how many frames behind it is */
+    uint64_t frame;
+
+    /* Held by the compositor until it sends wl_buffer.release */
     bool busy;
+    /* Dropped from the swapchain while busy, freed on release */
+    bool orphan;
+
+    /* Sub-allocated from the display's pool, pixels follow its generation */
+    struct wk_shm_pool *pool;
+    size_t offset;
+    uint32_t generation;
 
     void *pixels;
     struct wl_buffer *wl_buffer;
+    cairo_surface_t *cairo_surface;
+    cairo_t *cairo;
 };
 
-/* Formats are found by the format event of wl_shm_listener */
-struct wk_window_format {
-    uint32_t value;
+/* Retained offscreen surface of one layer, used with WKW_COMPOSITE */
+struct wk_layer {
+    int layer;
+    uint32_t id;
+    int32_t width, height;
+
+    cairo_surface_t *surface;
+    cairo_t *cairo;
+
+    /* Damage to redraw, and what the frame being rendered redraws */
+    struct wk_region damage;
+    struct wk_region redraw;
 
-    /* Next format in list */
-    struct wk_window_format *next;
+    /* Next layer up */
+    struct wk_layer *next;
+};
+
+/* Own wl_surface of a context, placed over the window's with a
+ * wl_subsurface */
+struct wk_plane {
+    struct wl_surface *surface;
+    struct wl_subsurface *subsurface;
+    int mode;
+
+    /* Small swapchain at the context's size, buffer is the one shown */
+    struct wk_window_buffer *buffer;
+    struct wk_window_buffer *buffers[WK_PLANE_BUFFERS];
+    int buffer_count;
+
+    /* Damage in context coordinates, and the frame's in the window's */
+    struct wk_region damage;
+    struct wk_region repaint;
+    struct wl_callback *frame_cb;
+
+    /* Position changed, set with the window's next commit */
+    bool moved;
+};
+
+/* Swapchain counters, see wk_window_render() */
+struct wk_window_stats {
+    uint64_t frames;    /* Frames committed */
+    uint64_t waits;     /* Renders skipped because every buffer was busy */
+    uint64_t allocs;    /* Buffers allocated */
+    uint64_t resizes;   /* Buffers resized in place, see WKW_ELASTIC */
+    _Atomic uint64_t requests; /* Calls to wk_window_invalidate() */
+
+    /* Damaged pixels against buffer pixels, last frame and in total */
+    int64_t frame_damage, frame_pixels;
+    int64_t damage_pixels, total_pixels;
+
+    /* Pixels copied forward between swapchain buffers, in total */
+    int64_t copied_pixels;
+
+    /* Renders scheduled with WKW_PACED, those that committed too late
+     * to make their vblank, and those the compositor showed after it */
+    uint64_t paced, missed, late;
+};
+
+/* A commit waiting for its wp_presentation_feedback */
+struct wk_feedback {
+    struct wp_presentation_feedback *wp_feedback;
+    struct wk_window *win;
+    uint64_t commit;
+
+    /* Vblank a paced frame aimed for, 0 otherwise */
+    uint64_t target;
+
+    /* Next pending feedback */
+    struct wk_feedback *next;
+};
+
+/* Frame timing in nanoseconds of the display's clock, kept with
+ * WKW_TIMING. Draw times are per context, see wk_context.timing */
+struct wk_window_timing {
+    struct wk_hist render;      /* wk_window_render() up to the commit */
+    struct wk_hist interval;    /* Between commits */
+    struct wk_hist wait;        /* Waiting for the compositor to release a buffer */
+    struct wk_hist present;     /* Commit to presentation, with wp_presentation */
+    uint64_t discarded;         /* Frames the compositor never showed */
+
+    uint64_t commit;
+    uint64_t wait_start;
+};
+
+/* Deadline pacing with WKW_PACED, times in the display's clock */
+struct wk_window_pacing {
+    struct wk_source *timer;
+
+    /* Last vblank seen and the refresh period, 0 until known */
+    uint64_t vblank, refresh;
+
+    /* Render cost estimate, and the vblank the next render aims for */
+    uint64_t cost;
+    uint64_t target;
+};
+
+/* Dynamic resolution with WKW_SCALING. Buffers are the window size
+ * times scale / WK_SCALE_ONE, the viewport stretches them back */
+struct wk_window_scaling {
+    struct wp_viewport *viewport;
+    int scale, min, max;
+
+    /* Destination set on the viewport, -1 when unset */
+    int32_t width, height;
+
+    /* Render time average, and frames over or under budget in a row */
+    uint64_t average;
+    int over, under;
+    uint64_t changes;
+
+    /* Armed while below max, the next render restores max once it fired */
+    struct wk_source *idle_timer;
+    atomic_bool idle;
 };
 
 /* Main window structure */
@@ -32,27 +211,118 @@ struct wk_window {
     struct zxdg_surface_v6 *zxdg_surface;
     struct zxdg_toplevel_v6 *zxdg_toplevel;
 
-    /* Creating display */
+    /* Creating display, and the next window in its list */
     struct wk_display *disp;
+    struct wk_window *next;
+
+    /* Private queue of our proxies, dispatched by our own thread with
+     * wk_window_set_threaded() or by the display loop */
+    struct wl_event_queue *queue;
+    pthread_t thread;
+    bool threaded;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    bool woken, stop;
 
     /* Window objects */
     uint32_t flags;
     int32_t width;
     int32_t height;
     char *title;
+
+    /* Latest configure, applied and acked by the next render */
+    int32_t pending_width, pending_height;
+    uint32_t configure_serial;
+    bool configure_pending, configure_ack;
+
+    /* The opaque region changed since the last commit */
+    bool opaque_dirty;
+
+    /* Render scheduling, see wk_window_ready() */
+    bool configured;
+    atomic_bool dirty;
+    struct wl_callback *frame_cb;
+    uint32_t frame_time;
+
+    /* Damage accumulated since the last commit, in window coordinates */
+    pthread_mutex_t lock;
+    struct wk_region damage;
+
+    /* Damage of the last frames in buffer coordinates, indexed by frame
+     * number */
+    struct wk_region history[WK_DAMAGE_HISTORY];
+
+    /* What the frame being rendered repaints, and who draws it */
+    struct wk_region repaint;
+    struct wk_context **draw_list;
+    struct wk_job *jobs;
+    int draw_cap;
+
+    /* Events of the context being dispatched, see _dispatch_context() */
+    struct wk_event *batch;
+    int batch_cap;
+
+    /* Buffer scale, see wk_window_set_scaling() */
+    struct wk_window_scaling scaling;
+
+    /* Render scheduling, see wk_window_set_paced() */
+    struct wk_window_pacing pacing;
+
+    /* Commits waiting for presentation feedback, for timing and pacing */
+    struct wk_feedback *feedback_head;
+
+    /* Swapchain, buffer points to the one drawn last */
     struct wk_window_buffer *buffer;
+    struct wk_window_buffer *buffers[WK_MAX_BUFFERS];
+    int buffer_count;
+    int buffer_limit;
+    uint32_t buffer_serial;
+    struct wk_window_stats stats;
+    struct wk_window_timing *timing;
 
-    /* List of wk_contexts */
+    /* List of wk_contexts, sorted from the lowest layer up */
     struct wk_context *context_head;
+    uint64_t context_serial;
+
+    /* Spatial index over the contexts, for hit-testing and damage */
+    struct wk_grid grid;
 
-    /* List of shm formats */
-    struct wk_window_format *format_head;
+    /* Layer caches, sorted from the lowest layer up */
+    struct wk_layer *layer_head;
 };
 
 /* Functions */
 struct wk_window *wk_window_create(struct wk_display *disp, int width, int height);
-void wk_window_register_draw(struct wk_window *win, void (*fun)(uint32_t width,
-            uint32_t height, void *pixels, cairo_t *cairo));
-void wk_window_render(struct wk_window *win);
+void wk_window_set_buffer_limit(struct wk_window *win, int limit);
+void wk_window_set_composite(struct wk_window *win, bool enable);
+void wk_window_set_elastic(struct wk_window *win, bool enable);
+void wk_window_set_threaded(struct wk_window *win, bool enable);
+void wk_window_set_timing(struct wk_window *win, bool enable);
+void wk_window_set_opaque(struct wk_window *win, bool enable);
+void wk_window_set_paced(struct wk_window *win, bool enable);
+void wk_window_set_scaling(struct wk_window *win, bool enable, double low, double high);
+void wk_window_print_timing(struct wk_window *win, FILE *out);
+void wk_window_wake(struct wk_window *win);
+void wk_window_dispatch(struct wk_window *win);
+void wk_window_surface_origin(struct wk_window *win, struct wl_surface *surface,
+        int *x, int *y);
+void wk_window_invalidate(struct wk_window *win);
+void wk_window_damage(struct wk_window *win, int32_t x, int32_t y,
+        int32_t width, int32_t height);
+bool wk_window_ready(struct wk_window *win);
+bool wk_window_render(struct wk_window *win);
 void wk_window_destroy(struct wk_window *window);
+
+struct wk_context *wk_window_context(struct wk_window *win, wk_context_func function,
+        int layer, int x, int y, int width, int height);
+void wk_window_move_context(struct wk_window *win, struct wk_context *ctx,
+        int x, int y, int width, int height);
+void wk_window_remove_context(struct wk_window *win, struct wk_context *remove);
+void wk_context_invalidate(struct wk_context *ctx);
+void wk_context_set_opaque(struct wk_context *ctx, bool opaque);
+void wk_context_set_retained(struct wk_context *ctx, bool retained);
+void wk_context_set_subsurface(struct wk_context *ctx, int mode);
+void wk_context_set_batch(struct wk_context *ctx, wk_context_batch_func batch);
+void wk_context_invalidate_rect(struct wk_context *ctx, int32_t x, int32_t y,
+        int32_t width, int32_t height);
 #endif
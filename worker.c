@@ -0,0 +1,102 @@
+#include <pthread.h>
+#include "util.h"
+
+#include "worker.h"
+
+/* Claim and run the next job, called and returning with the lock held */
+static void _run_next(struct wk_workers *pool)
+{
+    struct wk_job *job = &pool->jobs[pool->next_job++];
+
+    pthread_mutex_unlock(&pool->lock);
+    job->func(job->data);
+    pthread_mutex_lock(&pool->lock);
+
+    if(--pool->pending == 0)
+        pthread_cond_signal(&pool->done);
+}
+
+static void *_worker_main(void *data)
+{
+    struct wk_workers *pool = data;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1) {
+        while(!pool->quit && pool->next_job >= pool->job_count)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        if(pool->quit)
+            break;
+
+        _run_next(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+struct wk_workers *wk_workers_create(int count)
+{
+    struct wk_workers *pool = fzalloc(sizeof(struct wk_workers));
+    pool->threads = fzalloc(count * sizeof(pthread_t));
+
+    pthread_mutex_init(&pool->run, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for(int i = 0; i < count; i++) {
+        if(pthread_create(&pool->threads[i], NULL, _worker_main, pool) != 0)
+            break;
+        pool->count++;
+    }
+
+    vlog("started %d render workers", pool->count);
+    return pool;
+}
+
+/* Run a batch of jobs and return once all of them finished. The caller
+ * takes jobs as well instead of sleeping */
+void wk_workers_run(struct wk_workers *pool, struct wk_job *jobs, int count)
+{
+    if(count <= 0)
+        return;
+
+    pthread_mutex_lock(&pool->run);
+    pthread_mutex_lock(&pool->lock);
+    pool->jobs = jobs;
+    pool->job_count = count;
+    pool->next_job = 0;
+    pool->pending = count;
+    pthread_cond_broadcast(&pool->work);
+
+    while(pool->next_job < pool->job_count)
+        _run_next(pool);
+
+    while(pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pool->jobs = NULL;
+    pool->job_count = 0;
+    pool->next_job = 0;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run);
+}
+
+void wk_workers_destroy(struct wk_workers *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,40 @@
+#ifndef WK_WORKER_H
+#define WK_WORKER_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*wk_job_func)(void *data);
+
+/* One unit of work handed to the pool */
+struct wk_job {
+    wk_job_func func;
+    void *data;
+};
+
+/* A fixed set of threads running batches of jobs */
+struct wk_workers {
+    pthread_t *threads;
+    int count;
+
+    /* Windows rendering on their own threads take turns */
+    pthread_mutex_t run;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* A batch was posted, or we are quitting */
+    pthread_cond_t done;    /* The last job of the batch finished */
+
+    /* Current batch, jobs are claimed in order under lock */
+    struct wk_job *jobs;
+    int job_count;
+    int next_job;
+    int pending;
+    bool quit;
+};
+
+/* Functions */
+struct wk_workers *wk_workers_create(int count);
+void wk_workers_run(struct wk_workers *pool, struct wk_job *jobs, int count);
+void wk_workers_destroy(struct wk_workers *pool);
+
+#endif /* WK_WORKER_H */